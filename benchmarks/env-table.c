@@ -0,0 +1,77 @@
+// env-table.c
+// Benchmark inserting and looking up bindings in the global environment.
+//
+// For each table size, bind that many new names, then time looking each of
+// them up, both by searching the hash table and through the symbol's own
+// pointer to its binding, which is what evaluation uses. The tables are
+// cumulative: each size adds its names to those bound by the smaller sizes.
+// Every time should stay roughly flat as the table grows.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "env.h"
+#include "obj.h"
+#include "setup.h"
+
+
+// Each size does at least this many lookups of each kind, cycling through its
+// names, so the small sizes can be timed.
+#define MIN_LOOKUPS 10000000
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench_size(long size) {
+    LispObject ** syms = malloc(size * sizeof(LispObject *));
+    char name[64];
+    for (long i = 0; i < size; ++i) {
+	sprintf(name, "env-bench-%ld-%ld", size, i);
+	syms[i] = get_sym(name);
+    }
+
+    double start = now();
+    for (long i = 0; i < size; ++i)
+	bind(syms[i], syms[i], false);
+    double insert = now() - start;
+
+    long rounds = (MIN_LOOKUPS + size - 1) / size;
+    long found = 0;
+
+    start = now();
+    for (long r = 0; r < rounds; ++r)
+	for (long i = 0; i < size; ++i)
+	    found += (find_binding(syms[i]) != NULL);
+    double search = now() - start;
+
+    start = now();
+    for (long r = 0; r < rounds; ++r)
+	for (long i = 0; i < size; ++i)
+	    found += (get_def(syms[i]) != NULL);
+    double get = now() - start;
+
+    if (found != 2 * rounds * size)
+	printf("Missing bindings!\n");
+
+    double lookups = (double) rounds * size;
+    printf("%8ld bindings: insert %6.1f ns, find_binding %6.1f ns, "
+	   "get_def %6.1f ns, capacity %lu\n",
+	   size, insert * 1e9 / size, search * 1e9 / lookups,
+	   get * 1e9 / lookups, env_capacity);
+
+    free(syms);
+}
+
+
+int main() {
+    init_setup();
+    for (long size = 10; size <= 1000000; size *= 10)
+	bench_size(size);
+}
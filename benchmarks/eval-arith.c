@@ -0,0 +1,81 @@
+// eval-arith.c
+// Benchmark tight arithmetic loops.
+//
+// Time a tail-recursive loop whose body is mostly calls to the arithmetic
+// builtins, with both evaluators, and time calling the builtins directly
+// from C. Every call checks the types of its arguments and the result for
+// overflow, so this measures what those checks cost.
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "builtins.h"
+#include "obj.h"
+#include "parse-eval.h"
+#include "setup.h"
+#include "stack.h"
+
+
+#define ITERATIONS 1000000
+
+#define DIRECT_CALLS 20000000
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench_loop(char * mode) {
+    parse_eval(mode);
+
+    char input[64];
+    sprintf(input, "(arith %d 0)", ITERATIONS);
+
+    double start = now();
+    parse_eval(input);
+    double elapsed = now() - start;
+
+    printf("%-24s %6.1f ns per iteration\n", mode,
+	   elapsed * 1e9 / ITERATIONS);
+}
+
+
+void bench_direct(char * name, LispObject * (* b_func_n)(long, long)) {
+    push(get_int(12345));
+    push(get_int(678));
+    push(get_int(9));
+
+    long failed = 0;
+    double start = now();
+    for (long i = 0; i < DIRECT_CALLS; ++i)
+	failed += (b_func_n(stack_ptr - 2, 3) == NULL);
+    double elapsed = now() - start;
+
+    pop_n(3);
+    if (failed != 0)
+	printf("%s failed!\n", name);
+    printf("%-24s %6.1f ns per call\n", name, elapsed * 1e9 / DIRECT_CALLS);
+}
+
+
+int main() {
+    init_setup();
+
+    // Each iteration makes a three-argument call to each of +, -, *, and /,
+    // which go through the builtin calling convention rather than the
+    // virtual machine's instructions for two-argument + and -.
+    parse_eval("(define arith (lambda (n acc) (cond ((< n 1) acc) "
+	       "(t (arith (- n 1) (+ (- acc n 1) (* n 3 2) (/ n 7 2)))))))");
+
+    bench_loop("(define use-bytecode f)");
+    bench_loop("(define use-bytecode t)");
+    bench_direct("b_add", &b_add);
+    bench_direct("b_sub", &b_sub);
+    bench_direct("b_mul", &b_mul);
+    bench_direct("b_div", &b_div);
+    bench_direct("b_lt", &b_lt);
+}
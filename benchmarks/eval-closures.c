@@ -0,0 +1,60 @@
+// eval-closures.c
+// Benchmark calls to closures that refer to variables of enclosing functions.
+//
+// Make a function nested several lambdas deep whose body refers to a variable
+// of each enclosing lambda, and time calling it in a loop, and then time the
+// same loop with a function that only refers to its own parameter. Each
+// variable reference costs the same however deeply it is nested, so the two
+// times should be close.
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "parse-eval.h"
+#include "setup.h"
+
+
+#define RUNS 200
+
+// Each run makes this many calls to the function, in a loop that recurses
+// once per call.
+#define CALLS 2000
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench(char * name, char * def) {
+    parse_eval(def);
+
+    char input[64];
+    sprintf(input, "(loop %d)", CALLS);
+
+    double start = now();
+    for (int i = 0; i < RUNS; ++i)
+	parse_eval(input);
+    double elapsed = now() - start;
+
+    printf("%-8s %8.1f ns per call\n", name,
+	   elapsed * 1e9 / ((double) RUNS * CALLS));
+}
+
+
+int main() {
+    init_setup();
+
+    bench("nested",
+	  "(define loop (((((lambda (a) (lambda (b) (lambda (c) (lambda (d) "
+	  "(lambda (n) (cond ((< n 1) 0) "
+	  "(t (+ (loop (- n 1)) (+ a (+ b (+ c d))))))))))) "
+	  "1) 2) 3) 4))");
+
+    bench("flat",
+	  "(define loop (lambda (n) (cond ((< n 1) 0) "
+	  "(t (+ (loop (- n 1)) (+ n (+ n (+ n n))))))))");
+}
@@ -0,0 +1,57 @@
+// eval-fib.c
+// Benchmark a call-heavy program with the tree-walking evaluator and with the
+// bytecode virtual machine.
+//
+// Time the naive recursive definition of Fibonacci numbers with use-bytecode
+// set to f and then to t. Nearly all of the time goes to calls, cond, and
+// arithmetic, so this shows the cost of dispatch and of calling a function.
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "parse-eval.h"
+#include "setup.h"
+
+
+#define RUNS 5
+
+#define N 25
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench(char * use_bytecode) {
+    char input[64];
+    sprintf(input, "(define use-bytecode %s)", use_bytecode);
+    parse_eval(input);
+
+    sprintf(input, "(fib %d)", N);
+    double best = 0;
+    for (int i = 0; i < RUNS; ++i) {
+	double start = now();
+	parse_eval(input);
+	double elapsed = now() - start;
+	if (i == 0 || elapsed < best)
+	    best = elapsed;
+    }
+
+    printf("use-bytecode %s: (fib %d) in %.1f ms\n", use_bytecode, N,
+	   best * 1e3);
+}
+
+
+int main() {
+    init_setup();
+
+    parse_eval("(define fib (lambda (n) (cond ((< n 2) n) "
+	       "(t (+ (fib (- n 1)) (fib (- n 2)))))))");
+
+    bench("f");
+    bench("t");
+}
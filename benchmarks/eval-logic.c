@@ -0,0 +1,53 @@
+// eval-logic.c
+// Benchmark a loop whose cond tests are built from and, or, and not.
+//
+// Time a tail-recursive loop that counts the odd numbers below n with both
+// evaluators. Each iteration evaluates a not, an and, and an or, whose
+// operands after the first don't always need to be evaluated, so this shows
+// the cost of boolean logic in guard-heavy predicates.
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "parse-eval.h"
+#include "setup.h"
+
+
+#define ITERATIONS 1000000
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench(char * mode) {
+    parse_eval(mode);
+
+    char input[64];
+    sprintf(input, "(count-odd %d 0)", ITERATIONS);
+
+    double start = now();
+    parse_eval(input);
+    double elapsed = now() - start;
+
+    printf("%-24s %6.1f ns per iteration\n", mode,
+	   elapsed * 1e9 / ITERATIONS);
+}
+
+
+int main() {
+    init_setup();
+
+    parse_eval("(define count-odd (lambda (n acc) (cond "
+	       "((not (< 0 n)) acc) "
+	       "((and (int? acc) (or (= n 1) (not (= n (* 2 (/ n 2)))))) "
+	       "(count-odd (- n 1) (+ acc 1))) "
+	       "(t (count-odd (- n 1) acc)))))");
+
+    bench("(define use-bytecode f)");
+    bench("(define use-bytecode t)");
+}
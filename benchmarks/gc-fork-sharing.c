@@ -0,0 +1,102 @@
+// gc-fork-sharing.c
+// Benchmark how much memory forked children stop sharing with their parent
+// when they collect garbage.
+//
+// Build a large live heap, promote it to the old generation, and then fork a
+// few children. Each child runs several full collections and reports how many
+// kilobytes of its memory became private, that is, were copied on write
+// because the child wrote to them. Live objects are never written by the
+// collector, so this should be a small fraction of the heap.
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "gc.h"
+#include "heap.h"
+#include "obj.h"
+#include "setup.h"
+#include "stack.h"
+
+
+#define LIVE_PAIRS 2000000
+
+#define CHILDREN 4
+
+#define COLLECTIONS 5
+
+
+// private_dirty_kb
+// Return the Private_Dirty total from /proc/self/smaps_rollup, or -1 if it
+// can't be read.
+long private_dirty_kb() {
+    FILE * file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == NULL)
+	return -1;
+
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file) != NULL)
+	if (sscanf(line, "Private_Dirty: %ld kB", &kb) == 1)
+	    break;
+    fclose(file);
+    return kb;
+}
+
+
+void run_child(int child) {
+    long before = private_dirty_kb();
+    for (int i = 0; i < COLLECTIONS; ++i)
+	collect_garbage();
+    long after = private_dirty_kb();
+    if (before < 0 || after < 0) {
+	printf("child %d: /proc/self/smaps_rollup is not available\n", child);
+	exit(1);
+    }
+
+    long heap_kb = heap_page_count * HEAP_PAGE_SIZE / 1024;
+    printf("child %d: %6ld KiB of %ld KiB heap became private after %d "
+	   "collections (%.1f%%)\n", child, after - before, heap_kb,
+	   COLLECTIONS, 100.0 * (after - before) / heap_kb);
+    exit(0);
+}
+
+
+int main() {
+    init_setup();
+
+    // Mark with more than one thread, so that the children are forked after
+    // the collector's thread pool has been started.
+    bind(LISP_GC_THREADS, get_int(2), false);
+
+    LispObject * live = LISP_EMPTY;
+    push(live);
+    for (long i = 0; i < LIVE_PAIRS; ++i) {
+	live = b_cons(get_int(i), live);
+	stack[stack_ptr] = live;
+    }
+    bind(get_sym("live"), live, false);
+    pop();
+
+    // Promote everything and finish sweeping, so the children start with an
+    // old, fully swept heap.
+    collect_garbage();
+    collect_garbage();
+    printf("%lu live objects in %lu pages\n", heap_object_count,
+	   heap_page_count);
+    fflush(stdout);
+
+    for (int i = 0; i < CHILDREN; ++i)
+	if (fork() == 0)
+	    run_child(i);
+
+    int status;
+    for (int i = 0; i < CHILDREN; ++i)
+	wait(&status);
+}
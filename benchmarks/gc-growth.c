@@ -0,0 +1,58 @@
+// gc-growth.c
+// Benchmark allocation throughput as the size of the live set grows.
+//
+// For each live set size, build a list of that many pairs that stays
+// reachable, then time the allocation of short-lived pairs. With a fixed
+// collection threshold, throughput collapses once the live set outgrows the
+// threshold; with a heap growth factor, it should stay roughly flat.
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "gc.h"
+#include "heap.h"
+#include "obj.h"
+#include "setup.h"
+#include "stack.h"
+
+
+#define SHORT_LIVED_PAIRS 2000000
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+void bench_live_set(long live_pairs) {
+    // Keep the live list on the stack so it survives every collection.
+    LispObject * live = LISP_EMPTY;
+    push(live);
+    for (long i = 0; i < live_pairs; ++i) {
+	live = b_cons(get_int(i), live);
+	stack[stack_ptr] = live;
+    }
+
+    double start = now();
+    for (long i = 0; i < SHORT_LIVED_PAIRS; ++i)
+	b_cons(get_int(i), LISP_EMPTY);
+    double elapsed = now() - start;
+
+    printf("%10ld live pairs: %8.2f M allocations/s, heap limit %lu KiB\n",
+	   live_pairs, SHORT_LIVED_PAIRS / elapsed / 1e6, gc_heap_limit / 1024);
+
+    pop();
+    collect_garbage();
+}
+
+
+int main() {
+    init_setup();
+    bench_live_set(1000);
+    bench_live_set(10000);
+    bench_live_set(100000);
+    bench_live_set(1000000);
+}
@@ -0,0 +1,79 @@
+// gc-parallel-mark.c
+// Benchmark full collections of a large live heap with different numbers of
+// marking threads.
+//
+// Bind a few large trees of pairs in the global environment, then time
+// collect_garbage with gc-threads set to 1, 2, 4, ... up to the number of
+// processors. Nothing is freed, so the time is mostly marking, which should
+// speed up with each thread up to the number of cores.
+
+
+#include <stdio.h>
+#include <time.h>
+
+#include "env.h"
+#include "gc.h"
+#include "heap.h"
+#include "obj.h"
+#include "parallel-mark.h"
+#include "setup.h"
+#include "stack.h"
+
+
+#define TREES 8
+
+// Each tree has 2^TREE_DEPTH - 1 pairs.
+#define TREE_DEPTH 20
+
+#define COLLECTIONS 5
+
+
+double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+LispObject * make_tree(long depth) {
+    if (depth == 0)
+	return get_int(depth);
+    push(make_tree(depth - 1));
+    LispObject * tree = b_cons(stack[stack_ptr], make_tree(depth - 1));
+    pop();
+    return tree;
+}
+
+
+double bench_threads(long threads) {
+    bind(LISP_GC_THREADS, get_int(threads), false);
+
+    double start = now();
+    for (int i = 0; i < COLLECTIONS; ++i)
+	collect_garbage();
+    return (now() - start) / COLLECTIONS;
+}
+
+
+int main() {
+    init_setup();
+
+    char name[32];
+    for (int i = 0; i < TREES; ++i) {
+	sprintf(name, "tree-%d", i);
+	bind(get_sym(name), make_tree(TREE_DEPTH), false);
+    }
+    printf("%lu live objects\n", heap_object_count);
+
+    double serial = bench_threads(1);
+    printf("%3d threads: %8.2f ms per collection\n", 1, serial * 1000);
+
+    long max_threads = cpu_count();
+    if (max_threads > GC_MAX_THREADS)
+	max_threads = GC_MAX_THREADS;
+    for (long threads = 2; threads <= max_threads; threads *= 2) {
+	double elapsed = bench_threads(threads);
+	printf("%3ld threads: %8.2f ms per collection, %.2fx speedup\n",
+	       threads, elapsed * 1000, serial / elapsed);
+    }
+}
@@ -0,0 +1,131 @@
+// gc-pauses.c
+// Benchmark collection pause times with and without a pause budget.
+//
+// Keep a large live list reachable, then repeatedly build and drop lists that
+// live long enough to be promoted out of the nursery, and print a histogram of
+// each kind of collection pause: stop-the-world marking, minor collections,
+// and slices of incremental marking or of sweeping. The dropped lists fill the
+// old generation with garbage, so full collections keep happening. With
+// stop-the-world collection, each one pauses for time proportional to the
+// heap. With gc-pause-budget set, no pause should take much longer than the
+// budget, and the longest pause is reported against it.
+
+
+#include <stdio.h>
+
+#include "env.h"
+#include "gc.h"
+#include "heap.h"
+#include "obj.h"
+#include "setup.h"
+#include "stack.h"
+
+
+#define LIVE_PAIRS 1000000
+
+#define MEDIUM_LIVED_LISTS 400
+
+#define MEDIUM_LIVED_PAIRS 50000
+
+
+void reset_pauses() {
+    for (int k = 0; k < GC_PAUSE_KINDS; ++k) {
+	for (int i = 0; i < GC_PAUSE_BUCKETS; ++i)
+	    gc_pause_histogram[k][i] = 0;
+	gc_max_pause_us[k] = 0;
+    }
+    gc_stats.max_pause_us = 0;
+}
+
+
+// print_pauses
+// Print the histogram of each kind of pause that happened.
+void print_pauses() {
+    char * names[GC_PAUSE_KINDS] = {
+	[GC_PAUSE_FULL] = "full collections",
+	[GC_PAUSE_MINOR] = "minor collections",
+	[GC_PAUSE_SLICE] = "incremental slices"
+    };
+
+    for (int k = 0; k < GC_PAUSE_KINDS; ++k) {
+	unsigned long count = 0;
+	for (int i = 0; i < GC_PAUSE_BUCKETS; ++i)
+	    count += gc_pause_histogram[k][i];
+	if (count == 0)
+	    continue;
+	printf("  %s (%lu):\n", names[k], count);
+	print_pause_histogram(k);
+    }
+}
+
+
+// bench_pauses
+// Run the benchmark with the given pause budget in microseconds, where 0
+// means stop-the-world collection.
+void bench_pauses(long budget_us) {
+    bind(LISP_GC_PAUSE_BUDGET, (budget_us > 0 ? get_int(budget_us) : LISP_F),
+	 false);
+    collect_garbage();
+    reset_pauses();
+
+    LispObject * list;
+    push(LISP_EMPTY);
+    for (long i = 0; i < MEDIUM_LIVED_LISTS; ++i) {
+	list = LISP_EMPTY;
+	for (long j = 0; j < MEDIUM_LIVED_PAIRS; ++j) {
+	    list = b_cons(get_int(j), list);
+	    stack[stack_ptr] = list;
+	}
+    }
+    pop();
+
+    if (budget_us > 0)
+	printf("gc-pause-budget %ld us:\n", budget_us);
+    else
+	printf("stop-the-world:\n");
+    print_pauses();
+
+    printf("max pause: %lu us", gc_stats.max_pause_us);
+    if (budget_us > 0)
+	printf(", %.1fx the budget", (double) gc_stats.max_pause_us / budget_us);
+    printf("\n");
+
+    // A single long pause can be the system preempting the process, so also
+    // count the pauses in the buckets of at least twice the budget.
+    if (budget_us > 0) {
+	int first = 1;
+	while ((1L << (first - 1)) < 2 * budget_us)
+	    ++first;
+	unsigned long over = 0;
+	unsigned long total = 0;
+	for (int k = 0; k < GC_PAUSE_KINDS; ++k) {
+	    for (int i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+		total += gc_pause_histogram[k][i];
+		if (i >= first)
+		    over += gc_pause_histogram[k][i];
+	    }
+	}
+	printf("pauses of %ld us or more: %lu of %lu\n", 1L << (first - 1),
+	       over, total);
+    }
+    printf("\n");
+}
+
+
+int main() {
+    init_setup();
+
+    // Keep the live list on the stack so it survives every collection.
+    LispObject * live = LISP_EMPTY;
+    push(live);
+    for (long i = 0; i < LIVE_PAIRS; ++i) {
+	live = b_cons(get_int(i), live);
+	stack[stack_ptr] = live;
+    }
+
+    bench_pauses(0);
+    bench_pauses(1000);
+    bench_pauses(200);
+
+    pop();
+}
@@ -0,0 +1,444 @@
+// ast.c
+// Source for the abstract syntax tree.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ast.h"
+#include "compile.h"
+#include "error.h"
+#include "eval.h"
+#include "obj.h"
+#include "print.h"
+#include "stack.h"
+
+
+// ============================================================================
+// Private types
+// ============================================================================
+
+// The parameter lists of the lambda expressions that enclose the expression
+// being analyzed, innermost first.
+struct scope {
+    LispObject * params;
+    struct scope * parent;
+};
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+struct node * analyze_expr(LispObject * expr, struct scope * scope);
+
+struct node * analyze_form(LispObject * expr, struct scope * scope);
+
+struct node * analyze_cond(LispObject * expr, struct scope * scope);
+
+struct node * analyze_logic(LispObject * expr, struct scope * scope);
+
+struct node * analyze_define(LispObject * expr, struct scope * scope);
+
+struct node * analyze_lambda(LispObject * expr, struct scope * scope);
+
+struct node * analyze_call(LispObject * expr, struct scope * scope);
+
+bool resolve_local(struct node * node, struct scope * scope);
+
+struct node * new_node(NodeKind kind, LispObject * expr);
+
+void * alloc_or_exit(size_t size);
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// analyze
+// Analyze an expression that is to be evaluated in the global environment.
+//
+// On error:
+// - Print an error message and return NULL.
+struct node * analyze(LispObject * expr) {
+    return analyze_expr(expr, NULL);
+}
+
+
+// free_node
+// Free a tree of nodes.
+void free_node(struct node * node) {
+    switch (node->kind) {
+    case NODE_COND:
+	for (long i = 0; i < 2 * node->clause_count; ++i)
+	    free_node(node->clauses[i]);
+	free(node->clauses);
+	break;
+    case NODE_AND:
+    case NODE_OR:
+    case NODE_NOT:
+	for (long i = 0; i < node->operand_count; ++i)
+	    free_node(node->operands[i]);
+	free(node->operands);
+	break;
+    case NODE_DEFINE:
+	free_node(node->def);
+	break;
+    case NODE_LAMBDA:
+	release_code(node->code);
+	break;
+    case NODE_CALL:
+	free_node(node->func);
+	for (long i = 0; i < node->arg_count; ++i)
+	    free_node(node->args[i]);
+	free(node->args);
+	break;
+    default:
+	break;
+    }
+    free(node);
+}
+
+
+void retain_code(struct code * code) {
+    ++code->refcount;
+}
+
+
+// release_code
+// Drop a reference to a code, and free it if that was the last one. Called
+// when a lambda node is freed, and by the garbage collector when it frees a
+// function.
+void release_code(struct code * code) {
+    ASSERT(code->refcount > 0);
+
+    --code->refcount;
+    if (code->refcount == 0) {
+	free_node(code->body_node);
+	if (code->bytecode != NULL)
+	    free_bytecode(code->bytecode);
+	free(code);
+    }
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// analyze_expr
+// Analyze an expression inside the given scope. Each level of nesting counts
+// towards max-depth, because analyzing nested expressions recurses.
+struct node * analyze_expr(LispObject * expr, struct scope * scope) {
+    long frame = push_frame(0);
+    if (frame == 0)
+	return NULL;
+
+    struct node * node = analyze_form(expr, scope);
+
+    pop_frame(frame);
+    return node;
+}
+
+
+struct node * analyze_form(LispObject * expr, struct scope * scope) {
+    struct node * node;
+
+    if (b_int_pred(expr)
+	|| b_null_pred(expr)
+	|| get_type(expr) == TYPE_LAMBDA
+	|| is_builtin(expr)) {
+	node = new_node(NODE_CONST, expr);
+	node->value = expr;
+	return node;
+    }
+
+    if (b_symbol_pred(expr)) {
+	node = new_node(NODE_GLOBAL_REF, expr);
+	node->sym = expr;
+	if (resolve_local(node, scope))
+	    node->kind = NODE_LOCAL_REF;
+	return node;
+    }
+
+    if (!b_list_pred(expr)) {
+	ASSERT(b_pair_pred(expr));
+	INVALID_EXPR;
+	printf("Cannot evaluate a non-list pair\n");
+	return NULL;
+    }
+
+    if (car(expr) == LISP_QUOTE) {
+	if (length(cdr(expr)) != 1) {
+	    INVALID_EXPR;
+	    print_obj(LISP_QUOTE);
+	    printf(" takes 1 argument\n");
+	    return NULL;
+	}
+	node = new_node(NODE_CONST, expr);
+	node->value = car(cdr(expr));
+	return node;
+    }
+
+    if (car(expr) == LISP_COND)
+	return analyze_cond(expr, scope);
+
+    if (car(expr) == LISP_AND || car(expr) == LISP_OR
+	|| car(expr) == LISP_NOT)
+	return analyze_logic(expr, scope);
+
+    if (car(expr) == LISP_DEFINE)
+	return analyze_define(expr, scope);
+
+    if (car(expr) == LISP_LAMBDA)
+	return analyze_lambda(expr, scope);
+
+    return analyze_call(expr, scope);
+}
+
+
+struct node * analyze_cond(LispObject * expr, struct scope * scope) {
+    LispObject * clauses = cdr(expr);
+    LispObject * clause;
+    for (; !b_null_pred(clauses); clauses = cdr(clauses)) {
+	clause = car(clauses);
+
+	if (!b_list_pred(clause)) {
+	    INVALID_EXPR;
+	    print_obj(clause);
+	    printf(" is not a list\n");
+	    return NULL;
+	}
+
+	if (length(clause) != 2) {
+	    INVALID_EXPR;
+	    print_obj(clause);
+	    printf(" is not of length 2\n");
+	    return NULL;
+	}
+    }
+
+    struct node * node = new_node(NODE_COND, expr);
+    node->clause_count = length(cdr(expr));
+    node->clauses = alloc_or_exit(2 * node->clause_count
+				  * sizeof(struct node *));
+
+    // Analyze the tests and results in order, so that errors are reported in
+    // the order they appear in.
+    clauses = cdr(expr);
+    for (long i = 0; i < 2 * node->clause_count; ++i) {
+	clause = car(clauses);
+	node->clauses[i] = analyze_expr((i % 2 == 0 ? car(clause)
+					 : car(cdr(clause))), scope);
+	if (node->clauses[i] == NULL) {
+	    node->clause_count = i / 2;
+	    if (i % 2 == 1)
+		free_node(node->clauses[i - 1]);
+	    free_node(node);
+	    return NULL;
+	}
+	if (i % 2 == 1)
+	    clauses = cdr(clauses);
+    }
+    return node;
+}
+
+
+// analyze_logic
+// Analyze an and, or, or not expression. And and or take any number of
+// operands, and not takes one.
+struct node * analyze_logic(LispObject * expr, struct scope * scope) {
+    if (car(expr) == LISP_NOT && length(cdr(expr)) != 1) {
+	INVALID_EXPR;
+	print_obj(LISP_NOT);
+	printf(" takes 1 argument\n");
+	return NULL;
+    }
+
+    NodeKind kind = (car(expr) == LISP_AND ? NODE_AND
+		     : car(expr) == LISP_OR ? NODE_OR : NODE_NOT);
+    struct node * node = new_node(kind, expr);
+    node->operand_count = length(cdr(expr));
+    node->operands = alloc_or_exit(node->operand_count
+				   * sizeof(struct node *));
+
+    LispObject * operands = cdr(expr);
+    for (long i = 0; i < node->operand_count; ++i) {
+	node->operands[i] = analyze_expr(car(operands), scope);
+	if (node->operands[i] == NULL) {
+	    node->operand_count = i;
+	    free_node(node);
+	    return NULL;
+	}
+	operands = cdr(operands);
+    }
+    return node;
+}
+
+
+struct node * analyze_define(LispObject * expr, struct scope * scope) {
+    if (length(cdr(expr)) != 2) {
+	INVALID_EXPR;
+	print_obj(LISP_DEFINE);
+	printf(" takes 2 arguments\n");
+	return NULL;
+    }
+
+    LispObject * sym = car(cdr(expr));
+    if (!b_symbol_pred(sym)) {
+	INVALID_EXPR;
+	print_obj(sym);
+	printf(" is not a symbol\n");
+	return NULL;
+    }
+
+    struct node * def = analyze_expr(car(cdr(cdr(expr))), scope);
+    if (def == NULL)
+	return NULL;
+
+    struct node * node = new_node(NODE_DEFINE, expr);
+    node->name = sym;
+    node->def = def;
+    return node;
+}
+
+
+struct node * analyze_lambda(LispObject * expr, struct scope * scope) {
+    if (length(cdr(expr)) != 2) {
+	INVALID_EXPR;
+	print_obj(LISP_LAMBDA);
+	printf(" takes 2 arguments\n");
+	return NULL;
+    }
+
+    LispObject * params = car(cdr(expr));
+    if (!b_list_pred(params)) {
+	INVALID_EXPR;
+	print_obj(params);
+	printf(" is not a list\n");
+	return NULL;
+    }
+
+    // Check that all parameter names are symbols.
+    LispObject * rest;
+    for (rest = params; !b_null_pred(rest); rest = cdr(rest)) {
+	if (!b_symbol_pred(car(rest))) {
+	    INVALID_EXPR;
+	    print_obj(car(rest));
+	    printf(" is not a symbol\n");
+	    return NULL;
+	}
+    }
+
+    if (length(params) > FRAME_MAX_SLOTS) {
+	INVALID_EXPR;
+	printf("A function can't have more than %d parameters\n",
+	       FRAME_MAX_SLOTS);
+	return NULL;
+    }
+
+    // Check for duplicate parameter names.
+    LispObject * compare;
+    for (rest = params; !b_null_pred(rest); rest = cdr(rest)) {
+	for (compare = cdr(rest); !b_null_pred(compare);
+	     compare = cdr(compare)) {
+	    if (car(rest) == car(compare)) {
+		INVALID_EXPR;
+		printf("Duplicate argument name ");
+		print_obj(car(rest));
+		printf("\n");
+		return NULL;
+	    }
+	}
+    }
+
+    LispObject * body = car(cdr(cdr(expr)));
+    if (b_pair_pred(body) && !b_list_pred(body)) {
+	INVALID_EXPR;
+	print_obj(body);
+	printf(" is a non-list pair\n");
+	return NULL;
+    }
+
+    struct scope body_scope = {params, scope};
+    struct node * body_node = analyze_expr(body, &body_scope);
+    if (body_node == NULL)
+	return NULL;
+
+    struct code * code = alloc_or_exit(sizeof(struct code));
+    code->refcount = 1;
+    code->params = params;
+    code->body = body;
+    code->param_count = length(params);
+    code->body_node = body_node;
+    code->bytecode = NULL;
+
+    struct node * node = new_node(NODE_LAMBDA, expr);
+    node->code = code;
+    return node;
+}
+
+
+struct node * analyze_call(LispObject * expr, struct scope * scope) {
+    struct node * func = analyze_expr(car(expr), scope);
+    if (func == NULL)
+	return NULL;
+
+    struct node * node = new_node(NODE_CALL, expr);
+    node->func = func;
+    node->cache_version = 0;
+    node->cached_func = NULL;
+    node->arg_count = length(cdr(expr));
+    node->args = alloc_or_exit(node->arg_count * sizeof(struct node *));
+
+    LispObject * arg_exprs = cdr(expr);
+    for (long i = 0; i < node->arg_count; ++i) {
+	node->args[i] = analyze_expr(car(arg_exprs), scope);
+	if (node->args[i] == NULL) {
+	    node->arg_count = i;
+	    free_node(node);
+	    return NULL;
+	}
+	arg_exprs = cdr(arg_exprs);
+    }
+    return node;
+}
+
+
+// resolve_local
+// If a reference's symbol names a parameter of an enclosing lambda, set the
+// reference's depth and index and return true. Otherwise return false.
+bool resolve_local(struct node * node, struct scope * scope) {
+    LispObject * params;
+    long index;
+    for (long depth = 0; scope != NULL; scope = scope->parent, ++depth) {
+	index = 0;
+	for (params = scope->params; !b_null_pred(params);
+	     params = cdr(params), ++index) {
+	    if (car(params) == node->sym) {
+		node->depth = depth;
+		node->index = index;
+		return true;
+	    }
+	}
+    }
+    return false;
+}
+
+
+struct node * new_node(NodeKind kind, LispObject * expr) {
+    struct node * node = alloc_or_exit(sizeof(struct node));
+    node->kind = kind;
+    node->expr = expr;
+    return node;
+}
+
+
+void * alloc_or_exit(size_t size) {
+    void * ptr = malloc(size > 0 ? size : 1);
+    if (ptr == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+    return ptr;
+}
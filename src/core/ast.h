@@ -0,0 +1,134 @@
+// ast.h
+// Header for the abstract syntax tree.
+//
+// Before an expression is evaluated, it is analyzed into a tree of nodes. All
+// of the syntax checks (special forms with the wrong number of arguments,
+// malformed cond clauses, bad or duplicate lambda parameters, and so on) are
+// done once, by analyze, so that eval_node only has to execute the tree.
+// Whether a symbol refers to a lambda parameter or to a global definition is
+// also decided by analyze, which resolves each reference to a parameter to the
+// position of its variable in the chain of frames that eval_node will build at
+// run time.
+//
+// Nodes aren't Lisp objects. Every object a node refers to is part of the
+// expression it was analyzed from, so a tree is safe to evaluate as long as
+// that expression is protected from garbage collection.
+//
+// The body of each lambda expression is analyzed into a struct code, which
+// the lambda node and every function made from it share. A code is freed,
+// along with its bytecode, once nothing refers to it.
+
+
+#ifndef AST_H
+#define AST_H
+
+
+#include "obj.h"
+
+
+// See compile.h.
+struct bytecode;
+
+
+// ============================================================================
+// Nodes
+// ============================================================================
+
+typedef enum {
+	      NODE_CONST,
+	      NODE_LOCAL_REF,
+	      NODE_GLOBAL_REF,
+	      NODE_COND,
+	      NODE_AND,
+	      NODE_OR,
+	      NODE_NOT,
+	      NODE_DEFINE,
+	      NODE_LAMBDA,
+	      NODE_CALL
+} NodeKind;
+
+struct node {
+    NodeKind kind;
+
+    // The expression the node was analyzed from, for error messages.
+    LispObject * expr;
+
+    union {
+	// NODE_CONST
+	LispObject * value;
+
+	// NODE_LOCAL_REF, NODE_GLOBAL_REF. A local reference's variable is
+	// slot index of the frame found by following depth parent links from
+	// the current frame.
+	struct {
+	    LispObject * sym;
+	    long depth;
+	    long index;
+	};
+
+	// NODE_COND: clause i's test is clauses[2 * i] and its result is
+	// clauses[2 * i + 1].
+	struct {
+	    long clause_count;
+	    struct node ** clauses;
+	};
+
+	// NODE_AND, NODE_OR, NODE_NOT. A not has exactly one operand.
+	struct {
+	    long operand_count;
+	    struct node ** operands;
+	};
+
+	// NODE_DEFINE
+	struct {
+	    LispObject * name;
+	    struct node * def;
+	};
+
+	// NODE_LAMBDA
+	struct code * code;
+
+	// NODE_CALL. If func is a global reference, the function it was
+	// bound to the last time the call was evaluated is cached, along
+	// with the env_version it was found in, once check_call has
+	// accepted it. While env_version is the same, the call can skip
+	// both looking the function up and checking it.
+	struct {
+	    struct node * func;
+	    long arg_count;
+	    struct node ** args;
+	    unsigned long cache_version;
+	    LispObject * cached_func;
+	};
+    };
+};
+
+struct code {
+    long refcount;
+
+    // The lambda's parameter list and body, as written.
+    LispObject * params;
+    LispObject * body;
+
+    long param_count;
+    struct node * body_node;
+
+    // The body compiled to bytecode, or NULL if it hasn't been compiled yet.
+    struct bytecode * bytecode;
+};
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+struct node * analyze(LispObject * expr);
+
+void free_node(struct node * node);
+
+void retain_code(struct code * code);
+
+void release_code(struct code * code);
+
+
+#endif
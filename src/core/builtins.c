@@ -2,6 +2,7 @@
 // Source for miscellaneous builtin functions.
 
 
+#include <limits.h>
 #include <stdio.h>
 
 #include "builtins.h"
@@ -11,88 +12,108 @@
 
 
 // ============================================================================
-// Arithmetic
+// Private function prototypes
 // ============================================================================
 
-// b_add
-// Builtin Lisp function +.
-LispObject * b_add(LispObject * obj1, LispObject * obj2) {
-    if (!typecheck(obj1, LISP_INT_PRED_SYM)
-	|| !typecheck(obj2, LISP_INT_PRED_SYM))
-	return NULL;
+bool check_ints(long args, long arg_count);
 
-    // Protect operands from GC that could be triggered by get_int.
-    push(obj1);
-    push(obj2);
+long arg_value(long arg);
 
-    LispObject * result = get_int(obj1->value + obj2->value);
+LispObject * overflow();
 
-    pop();
-    pop();
+LispObject * division_by_zero();
 
-    return result;
-}
+LispObject * compare(long args, long arg_count, bool (* ordered)(long, long));
 
+bool int_eq(long x, long y);
 
-// b_sub
-// Builtin Lisp function -.
-LispObject * b_sub(LispObject * obj1, LispObject * obj2) {
-    if (!typecheck(obj1, LISP_INT_PRED_SYM)
-	|| !typecheck(obj2, LISP_INT_PRED_SYM))
-	return NULL;
+bool int_lt(long x, long y);
 
-    // Protect operands from GC that could be triggered by get_int.
-    push(obj1);
-    push(obj2);
+bool int_gt(long x, long y);
 
-    LispObject * result = get_int(obj1->value - obj2->value);
+bool int_le(long x, long y);
 
-    pop();
-    pop();
+bool int_ge(long x, long y);
 
-    return result;
-}
 
+// ============================================================================
+// Arithmetic
+// ============================================================================
+
+// Each of these folds over all of its arguments in a single call, so
+// intermediate results are never made into Lisp ints. The arguments don't
+// need to be protected from GC that could be triggered by get_int, because
+// they are on the stack. A result that doesn't fit in a long is an error.
 
-// b_mul
-// Builtin Lisp function *.
-LispObject * b_mul(LispObject * obj1, LispObject * obj2) {
-    if (!typecheck(obj1, LISP_INT_PRED_SYM)
-	|| !typecheck(obj2, LISP_INT_PRED_SYM))
+// b_add
+// Builtin Lisp function +. Return the sum of the arguments, or 0 if there are
+// none.
+LispObject * b_add(long args, long arg_count) {
+    if (!check_ints(args, arg_count))
 	return NULL;
 
-    // Protect operands from GC that could be triggered by get_int.
-    push(obj1);
-    push(obj2);
+    long sum = 0;
+    for (long i = 0; i < arg_count; ++i)
+	if (__builtin_add_overflow(sum, arg_value(args + i), &sum))
+	    return overflow();
+    return get_int(sum);
+}
 
-    LispObject * result = get_int(obj1->value * obj2->value);
 
-    pop();
-    pop();
+// b_sub
+// Builtin Lisp function -. Return the first argument minus the rest, or the
+// negation of the argument if there is only one.
+LispObject * b_sub(long args, long arg_count) {
+    if (!check_ints(args, arg_count))
+	return NULL;
 
-    return result;
+    long difference = arg_value(args);
+    if (arg_count == 1) {
+	if (__builtin_sub_overflow(0, difference, &difference))
+	    return overflow();
+	return get_int(difference);
+    }
+    for (long i = 1; i < arg_count; ++i)
+	if (__builtin_sub_overflow(difference, arg_value(args + i), &difference))
+	    return overflow();
+    return get_int(difference);
 }
 
 
-// TODO: error for divide by zero
-//
-// b_div
-// Builtin Lisp function /.
-LispObject * b_div(LispObject * obj1, LispObject * obj2) {
-    if (!typecheck(obj1, LISP_INT_PRED_SYM)
-	|| !typecheck(obj2, LISP_INT_PRED_SYM))
+// b_mul
+// Builtin Lisp function *. Return the product of the arguments, or 1 if there
+// are none.
+LispObject * b_mul(long args, long arg_count) {
+    if (!check_ints(args, arg_count))
 	return NULL;
 
-    // Protect operands from GC that could be triggered by get_int.
-    push(obj1);
-    push(obj2);
+    long product = 1;
+    for (long i = 0; i < arg_count; ++i)
+	if (__builtin_mul_overflow(product, arg_value(args + i), &product))
+	    return overflow();
+    return get_int(product);
+}
 
-    LispObject * result = get_int(obj1->value / obj2->value);
 
-    pop();
-    pop();
+// b_div
+// Builtin Lisp function /. Return the first argument divided by each of the
+// rest in turn, rounding toward zero, or 1 divided by the argument if there
+// is only one.
+LispObject * b_div(long args, long arg_count) {
+    if (!check_ints(args, arg_count))
+	return NULL;
 
-    return result;
+    long quotient = (arg_count == 1 ? 1 : arg_value(args));
+    long divisor;
+    for (long i = (arg_count == 1 ? 0 : 1); i < arg_count; ++i) {
+	divisor = arg_value(args + i);
+	if (divisor == 0)
+	    return division_by_zero();
+	if (divisor == -1 && quotient == LONG_MIN)
+	    return overflow();
+	quotient /= divisor;
+    }
+    return get_int(quotient);
 }
 
 
@@ -106,39 +127,146 @@ bool b_equal_pred(LispObject * obj1, LispObject * obj2) {
     if (obj1 == obj2)
 	return true;
 
-    if (obj1->type != obj2->type)
+    if (get_type(obj1) != get_type(obj2))
 	return false;
 
     if (b_int_pred(obj1))
-	return obj1->value == obj2->value;
-
-    if (b_symbol_pred(obj1)) {
-	long i = 0;
-	while (obj1->print_name[i] != '\0' && obj2->print_name[i] != '\0') {
-	    if (obj1->print_name[i] != obj2->print_name[i])
-		return false;
-	    ++i;
-	}
-	return obj1->print_name[i] == obj2->print_name[i];
-    }
+	return int_value(obj1) == int_value(obj2);
 
     if (b_pair_pred(obj1))
 	return b_equal_pred(car(obj1), car(obj2))
 	    && b_equal_pred(cdr(obj1), cdr(obj2));
 
-    if (obj1->type == TYPE_UNIQUE || b_function_pred(obj1))
-	// We already know they're not the same object.
+    if (b_symbol_pred(obj1)
+	|| get_type(obj1) == TYPE_UNIQUE
+	|| b_function_pred(obj1))
+	// We already know they're not the same object, and symbols are
+	// interned, so two symbols with the same name are the same object.
 	return false;
 
     FOUND_BUG;
 }
 
 
+// b_num_eq
+// Builtin Lisp function =. Return whether the arguments are all equal.
+LispObject * b_num_eq(long args, long arg_count) {
+    return compare(args, arg_count, &int_eq);
+}
+
+
 // b_lt
-// Builtin Lisp function <.
-LispObject * b_lt(LispObject * obj1, LispObject * obj2) {
-    if (!typecheck(obj1, LISP_INT_PRED_SYM)
-	|| !typecheck(obj2, LISP_INT_PRED_SYM))
+// Builtin Lisp function <. Return whether the arguments are increasing.
+LispObject * b_lt(long args, long arg_count) {
+    return compare(args, arg_count, &int_lt);
+}
+
+
+// b_gt
+// Builtin Lisp function >. Return whether the arguments are decreasing.
+LispObject * b_gt(long args, long arg_count) {
+    return compare(args, arg_count, &int_gt);
+}
+
+
+// b_le
+// Builtin Lisp function <=. Return whether the arguments are nondecreasing.
+LispObject * b_le(long args, long arg_count) {
+    return compare(args, arg_count, &int_le);
+}
+
+
+// b_ge
+// Builtin Lisp function >=. Return whether the arguments are nonincreasing.
+LispObject * b_ge(long args, long arg_count) {
+    return compare(args, arg_count, &int_ge);
+}
+
+
+// ============================================================================
+// Logic
+// ============================================================================
+
+// b_not
+// Builtin Lisp function not. A not expression is a special form that doesn't
+// call it, so this is only used when not is passed as a value.
+bool b_not(LispObject * obj) {
+    return obj == LISP_F;
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// check_ints
+// Return whether the arguments are all ints, printing a type error for the
+// first one that isn't.
+bool check_ints(long args, long arg_count) {
+    for (long i = 0; i < arg_count; ++i)
+	if (!check_type(stack[args + i], TYPE_INT, LISP_INT_PRED_SYM))
+	    return false;
+    return true;
+}
+
+
+// arg_value
+// Return the value of the int in stack[arg].
+//
+// Pre:
+// - check_ints returned true for the arguments.
+long arg_value(long arg) {
+    LispObject * obj = stack[arg];
+    return (is_fixnum(obj) ? fixnum_value(obj) : obj->value);
+}
+
+
+LispObject * overflow() {
+    printf("Integer overflow\n\n");
+    return NULL;
+}
+
+
+LispObject * division_by_zero() {
+    printf("Division by zero\n\n");
+    return NULL;
+}
+
+
+// compare
+// Return t if each argument is ordered with respect to the next, and f
+// otherwise.
+LispObject * compare(long args, long arg_count, bool (* ordered)(long, long)) {
+    if (!check_ints(args, arg_count))
 	return NULL;
-    return (obj1->value < obj2->value ? LISP_T : LISP_F);
+
+    for (long i = 1; i < arg_count; ++i)
+	if (!ordered(arg_value(args + i - 1), arg_value(args + i)))
+	    return LISP_F;
+    return LISP_T;
+}
+
+
+bool int_eq(long x, long y) {
+    return x == y;
+}
+
+
+bool int_lt(long x, long y) {
+    return x < y;
+}
+
+
+bool int_gt(long x, long y) {
+    return x > y;
+}
+
+
+bool int_le(long x, long y) {
+    return x <= y;
+}
+
+
+bool int_ge(long x, long y) {
+    return x >= y;
 }
@@ -15,13 +15,16 @@
 // Arithmetic
 // ============================================================================
 
-LispObject * b_add(LispObject * obj1, LispObject * obj2);
+// The arithmetic builtins and the numeric comparisons take any number of
+// arguments; see TYPE_BUILTIN_N.
 
-LispObject * b_sub(LispObject * obj1, LispObject * obj2);
+LispObject * b_add(long args, long arg_count);
 
-LispObject * b_mul(LispObject * obj1, LispObject * obj2);
+LispObject * b_sub(long args, long arg_count);
 
-LispObject * b_div(LispObject * obj1, LispObject * obj2);
+LispObject * b_mul(long args, long arg_count);
+
+LispObject * b_div(long args, long arg_count);
 
 
 // ============================================================================
@@ -30,7 +33,22 @@ LispObject * b_div(LispObject * obj1, LispObject * obj2);
 
 bool b_equal_pred(LispObject * obj1, LispObject * obj2);
 
-LispObject * b_lt(LispObject * obj1, LispObject * obj2);
+LispObject * b_num_eq(long args, long arg_count);
+
+LispObject * b_lt(long args, long arg_count);
+
+LispObject * b_gt(long args, long arg_count);
+
+LispObject * b_le(long args, long arg_count);
+
+LispObject * b_ge(long args, long arg_count);
+
+
+// ============================================================================
+// Logic
+// ============================================================================
+
+bool b_not(LispObject * obj);
 
 
 #endif
@@ -0,0 +1,385 @@
+// compile.c
+// Source for the bytecode compiler.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "builtins.h"
+#include "compile.h"
+#include "env.h"
+#include "error.h"
+#include "eval.h"
+#include "obj.h"
+
+
+// ============================================================================
+// Private types
+// ============================================================================
+
+// Bytecode being compiled. The arrays grow as needed.
+struct compiler {
+    struct bytecode * bytecode;
+    long code_capacity;
+    long constant_capacity;
+    long lambda_capacity;
+    long cache_capacity;
+};
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+void compile_node(struct compiler * c, struct node * node, bool tail);
+
+void compile_cond(struct compiler * c, struct node * node, bool tail);
+
+void compile_logic(struct compiler * c, struct node * node, bool tail);
+
+void compile_call(struct compiler * c, struct node * node, bool tail);
+
+LispObject * direct_builtin(struct node * node, Opcode * opcode);
+
+void patch_jumps(struct compiler * c, long jumps);
+
+void emit(struct compiler * c, int word);
+
+long add_constant(struct compiler * c, LispObject * obj);
+
+long add_lambda(struct compiler * c, struct code * code);
+
+long add_cache(struct compiler * c);
+
+void * grow_array(void * array, long * capacity, size_t element_size);
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// compile
+// Compile an analyzed expression into bytecode that returns its value.
+struct bytecode * compile(struct node * node) {
+    struct compiler c = {NULL, 0, 0, 0, 0};
+
+    c.bytecode = malloc(sizeof(struct bytecode));
+    if (c.bytecode == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+    c.bytecode->code = NULL;
+    c.bytecode->code_length = 0;
+    c.bytecode->constants = NULL;
+    c.bytecode->constant_count = 0;
+    c.bytecode->lambdas = NULL;
+    c.bytecode->lambda_count = 0;
+    c.bytecode->caches = NULL;
+    c.bytecode->cache_count = 0;
+
+    compile_node(&c, node, true);
+    emit(&c, OP_RETURN);
+    return c.bytecode;
+}
+
+
+// get_bytecode
+// Return the bytecode for the body of an analyzed lambda expression,
+// compiling it the first time.
+struct bytecode * get_bytecode(struct code * code) {
+    if (code->bytecode == NULL)
+	code->bytecode = compile(code->body_node);
+    return code->bytecode;
+}
+
+
+void free_bytecode(struct bytecode * bytecode) {
+    free(bytecode->code);
+    free(bytecode->constants);
+    free(bytecode->lambdas);
+    free(bytecode->caches);
+    free(bytecode);
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// compile_node
+// Compile a node into code that pushes its value. If tail is true, the value
+// is going to be returned, so calls can be compiled as tail calls.
+void compile_node(struct compiler * c, struct node * node, bool tail) {
+    switch (node->kind) {
+    case NODE_CONST:
+	emit(c, OP_CONST);
+	emit(c, add_constant(c, node->value));
+	return;
+
+    case NODE_LOCAL_REF:
+	if (node->depth == 0) {
+	    emit(c, OP_LOCAL_0);
+	}
+	else {
+	    emit(c, OP_LOCAL);
+	    emit(c, node->depth);
+	}
+	emit(c, node->index);
+	return;
+
+    case NODE_GLOBAL_REF:
+	emit(c, OP_GLOBAL);
+	emit(c, add_constant(c, node->sym));
+	return;
+
+    case NODE_COND:
+	compile_cond(c, node, tail);
+	return;
+
+    case NODE_AND:
+    case NODE_OR:
+	compile_logic(c, node, tail);
+	return;
+
+    case NODE_NOT:
+	compile_node(c, node->operands[0], false);
+	emit(c, OP_NOT);
+	return;
+
+    case NODE_DEFINE:
+	compile_node(c, node->def, false);
+	emit(c, OP_DEFINE);
+	emit(c, add_constant(c, node->expr));
+	return;
+
+    case NODE_LAMBDA:
+	emit(c, OP_LAMBDA);
+	emit(c, add_lambda(c, node->code));
+	return;
+
+    case NODE_CALL:
+	compile_call(c, node, tail);
+	return;
+    }
+    FOUND_BUG;
+}
+
+
+// compile_cond
+// Compile a cond expression into a test and a conditional jump past the
+// result for each clause, and code that pushes the empty list if no test
+// succeeds.
+void compile_cond(struct compiler * c, struct node * node, bool tail) {
+    // Each clause's result ends with a jump to the end of the cond. The
+    // jumps' targets aren't known until the end is reached, so they are
+    // linked through their operands until then.
+    long end_jumps = -1;
+    long next_clause;
+
+    for (long i = 0; i < node->clause_count; ++i) {
+	compile_node(c, node->clauses[2 * i], false);
+	emit(c, OP_JUMP_IF_F);
+	next_clause = c->bytecode->code_length;
+	emit(c, 0);
+
+	compile_node(c, node->clauses[2 * i + 1], tail);
+	emit(c, OP_JUMP);
+	emit(c, end_jumps);
+	end_jumps = c->bytecode->code_length - 1;
+
+	c->bytecode->code[next_clause] = c->bytecode->code_length;
+    }
+
+    emit(c, OP_CONST);
+    emit(c, add_constant(c, LISP_EMPTY));
+
+    patch_jumps(c, end_jumps);
+}
+
+
+// compile_logic
+// Compile an and or an or expression into each operand but the last followed
+// by a jump to the end that is taken if the operand decides the result, and
+// then the last operand.
+void compile_logic(struct compiler * c, struct node * node, bool tail) {
+    if (node->operand_count == 0) {
+	emit(c, OP_CONST);
+	emit(c, add_constant(c, (node->kind == NODE_AND ? LISP_T : LISP_F)));
+	return;
+    }
+
+    // As in compile_cond, the jumps to the end are linked through their
+    // operands.
+    long end_jumps = -1;
+    for (long i = 0; i < node->operand_count - 1; ++i) {
+	compile_node(c, node->operands[i], false);
+	emit(c, (node->kind == NODE_AND ? OP_AND_JUMP : OP_OR_JUMP));
+	emit(c, end_jumps);
+	end_jumps = c->bytecode->code_length - 1;
+    }
+
+    compile_node(c, node->operands[node->operand_count - 1], tail);
+
+    patch_jumps(c, end_jumps);
+}
+
+
+// compile_call
+// Compile a function application.
+void compile_call(struct compiler * c, struct node * node, bool tail) {
+    Opcode opcode;
+    LispObject * builtin = direct_builtin(node, &opcode);
+
+    if (builtin != NULL) {
+	for (long i = 0; i < node->arg_count; ++i)
+	    compile_node(c, node->args[i], false);
+	emit(c, opcode);
+	if (opcode == OP_CALL_BUILTIN_N)
+	    emit(c, node->arg_count);
+	emit(c, add_constant(c, node->expr));
+	add_constant(c, builtin);
+	return;
+    }
+
+    if (node->func->kind == NODE_GLOBAL_REF) {
+	emit(c, OP_CALLEE);
+	emit(c, node->arg_count);
+	emit(c, add_constant(c, node->expr));
+	add_constant(c, node->func->sym);
+	emit(c, add_cache(c));
+    }
+    else {
+	compile_node(c, node->func, false);
+	emit(c, OP_CHECK_CALL);
+	emit(c, node->arg_count);
+	emit(c, add_constant(c, node->expr));
+    }
+
+    for (long i = 0; i < node->arg_count; ++i)
+	compile_node(c, node->args[i], false);
+    emit(c, (tail ? OP_TAIL_CALL : OP_CALL));
+    emit(c, node->arg_count);
+    emit(c, add_constant(c, node->expr));
+}
+
+
+// direct_builtin
+// If a function application can be compiled into a single instruction,
+// because the function is named by a global that is constantly bound to a
+// builtin that takes as many arguments as it is given, return the builtin and
+// set opcode to the instruction. Otherwise return NULL.
+LispObject * direct_builtin(struct node * node, Opcode * opcode) {
+    if (node->func->kind != NODE_GLOBAL_REF || !is_constant(node->func->sym))
+	return NULL;
+
+    LispObject * func = get_def(node->func->sym);
+    LispType type = get_type(func);
+
+    if ((type == TYPE_BUILTIN_1 || type == TYPE_BOOL_BUILTIN_1)
+	&& node->arg_count == 1) {
+	if (type == TYPE_BUILTIN_1 && func->b_func_1 == &b_car)
+	    *opcode = OP_CAR;
+	else if (type == TYPE_BUILTIN_1 && func->b_func_1 == &b_cdr)
+	    *opcode = OP_CDR;
+	else
+	    *opcode = OP_CALL_BUILTIN_1;
+	return func;
+    }
+
+    if ((type == TYPE_BUILTIN_2 || type == TYPE_BOOL_BUILTIN_2)
+	&& node->arg_count == 2) {
+	if (type == TYPE_BUILTIN_2 && func->b_func_2 == &b_cons)
+	    *opcode = OP_CONS;
+	else
+	    *opcode = OP_CALL_BUILTIN_2;
+	return func;
+    }
+
+    if (type == TYPE_BUILTIN_N && node->arg_count >= func->min_args
+	&& (func->max_args == -1 || node->arg_count <= func->max_args)) {
+	if (node->arg_count == 2 && func->b_func_n == &b_add)
+	    *opcode = OP_ADD;
+	else if (node->arg_count == 2 && func->b_func_n == &b_sub)
+	    *opcode = OP_SUB;
+	else if (node->arg_count == 2 && func->b_func_n == &b_lt)
+	    *opcode = OP_LT;
+	else
+	    *opcode = OP_CALL_BUILTIN_N;
+	return func;
+    }
+
+    return NULL;
+}
+
+
+// patch_jumps
+// Point a chain of jumps, linked through their operands from the last one
+// emitted and ending with -1, at the next instruction to be emitted.
+void patch_jumps(struct compiler * c, long jumps) {
+    long next;
+    while (jumps != -1) {
+	next = c->bytecode->code[jumps];
+	c->bytecode->code[jumps] = c->bytecode->code_length;
+	jumps = next;
+    }
+}
+
+
+void emit(struct compiler * c, int word) {
+    struct bytecode * bytecode = c->bytecode;
+    if (bytecode->code_length == c->code_capacity)
+	bytecode->code = grow_array(bytecode->code, &c->code_capacity,
+				    sizeof(int));
+    bytecode->code[bytecode->code_length] = word;
+    ++bytecode->code_length;
+}
+
+
+// add_constant
+// Add an object to the constant pool and return its index.
+long add_constant(struct compiler * c, LispObject * obj) {
+    struct bytecode * bytecode = c->bytecode;
+    if (bytecode->constant_count == c->constant_capacity)
+	bytecode->constants = grow_array(bytecode->constants,
+					 &c->constant_capacity,
+					 sizeof(LispObject *));
+    bytecode->constants[bytecode->constant_count] = obj;
+    return bytecode->constant_count++;
+}
+
+
+long add_lambda(struct compiler * c, struct code * code) {
+    struct bytecode * bytecode = c->bytecode;
+    if (bytecode->lambda_count == c->lambda_capacity)
+	bytecode->lambdas = grow_array(bytecode->lambdas, &c->lambda_capacity,
+				       sizeof(struct code *));
+    bytecode->lambdas[bytecode->lambda_count] = code;
+    return bytecode->lambda_count++;
+}
+
+
+// add_cache
+// Add an empty call cache and return its index.
+long add_cache(struct compiler * c) {
+    struct bytecode * bytecode = c->bytecode;
+    if (bytecode->cache_count == c->cache_capacity)
+	bytecode->caches = grow_array(bytecode->caches, &c->cache_capacity,
+				      sizeof(struct call_cache));
+    bytecode->caches[bytecode->cache_count].version = 0;
+    bytecode->caches[bytecode->cache_count].func = NULL;
+    return bytecode->cache_count++;
+}
+
+
+// grow_array
+// Double the capacity of an array, or give it room for a few elements if it
+// has none yet.
+void * grow_array(void * array, long * capacity, size_t element_size) {
+    *capacity = (*capacity == 0 ? 8 : *capacity * 2);
+    array = realloc(array, *capacity * element_size);
+    if (array == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+    return array;
+}
@@ -0,0 +1,166 @@
+// compile.h
+// Header for the bytecode compiler.
+//
+// An analyzed expression (see ast.h) can be compiled to bytecode and run by
+// the virtual machine in vm.c instead of being evaluated by eval_node. The
+// bytecode for the body of a lambda expression is compiled the first time a
+// function made from it is called by the virtual machine, and kept in the
+// lambda's struct code.
+//
+// Bytecode is an array of ints, each an opcode followed by its operands. It
+// works on the stack: each instruction pops its operands off the stack and
+// pushes its result. Objects that an instruction needs, such as constants,
+// the symbols of global references, and expressions to print in error
+// messages, are kept in the bytecode's constant pool and referred to by
+// index. Like nodes, bytecode only refers to objects that are part of the
+// expression it was compiled from, or that can never be garbage collected.
+
+
+#ifndef COMPILE_H
+#define COMPILE_H
+
+
+#include "ast.h"
+#include "obj.h"
+
+
+// ============================================================================
+// Opcodes
+// ============================================================================
+
+// In the comments below, k is an index into the constant pool, and expr is
+// the expression that an instruction was compiled from, constants[k], which
+// is printed if the instruction signals an error. Where an instruction also
+// needs a builtin function, it is constants[k + 1].
+
+typedef enum {
+	      // const k: push constants[k].
+	      OP_CONST,
+
+	      // local depth index: push a variable of an enclosing frame.
+	      OP_LOCAL,
+
+	      // local-0 index: push a variable of the current frame.
+	      OP_LOCAL_0,
+
+	      // global k: push the definition of the symbol constants[k].
+	      OP_GLOBAL,
+
+	      // define k: bind the name defined by expr to the top object,
+	      // leaving it on the stack.
+	      OP_DEFINE,
+
+	      // lambda i: push a function made from lambdas[i] and the
+	      // current frame.
+	      OP_LAMBDA,
+
+	      // jump target: continue at code[target].
+	      OP_JUMP,
+
+	      // jump-if-f target: pop the top object, and continue at
+	      // code[target] if it is f.
+	      OP_JUMP_IF_F,
+
+	      // and-jump target: if the top object is f, continue at
+	      // code[target], leaving it on the stack. Otherwise pop it.
+	      OP_AND_JUMP,
+
+	      // or-jump target: if the top object isn't f, continue at
+	      // code[target], leaving it on the stack. Otherwise pop it.
+	      OP_OR_JUMP,
+
+	      // not: replace the top object with t if it is f, and with f
+	      // otherwise.
+	      OP_NOT,
+
+	      // check-call arg-count k: check that the top object is a
+	      // function that takes arg-count arguments. Emitted before the
+	      // arguments are evaluated.
+	      OP_CHECK_CALL,
+
+	      // callee arg-count k cache: like global and then check-call, for
+	      // a function named by the global constants[k + 1]. The function
+	      // is kept in caches[cache] with the env_version it was found in,
+	      // and while that is still current it is pushed without looking
+	      // it up or checking it.
+	      OP_CALLEE,
+
+	      // call arg-count k: apply the function below the top arg-count
+	      // objects to them, and replace all of them with the result.
+	      OP_CALL,
+
+	      // tail-call arg-count k: like call, but the result is returned.
+	      // If the function is a lambda, its body replaces the bytecode
+	      // being run instead of being run by a nested call.
+	      OP_TAIL_CALL,
+
+	      // return: return the top object.
+	      OP_RETURN,
+
+	      // call-builtin-1 k, call-builtin-2 k: apply the builtin function
+	      // constants[k + 1] to the top one or two objects and replace them
+	      // with the result. Emitted instead of check-call and call when the
+	      // function is a builtin that can never be redefined.
+	      OP_CALL_BUILTIN_1,
+	      OP_CALL_BUILTIN_2,
+
+	      // call-builtin-n arg-count k: like call-builtin-1, for a builtin
+	      // that takes any number of arguments, applied to the top
+	      // arg-count objects.
+	      OP_CALL_BUILTIN_N,
+
+	      // Like call-builtin-1 and call-builtin-2, for the builtins with
+	      // instructions of their own. These skip the call when their
+	      // arguments are of the expected types.
+	      OP_CAR,
+	      OP_CDR,
+	      OP_CONS,
+	      OP_ADD,
+	      OP_SUB,
+	      OP_LT,
+
+	      NUM_OPCODES
+} Opcode;
+
+
+// ============================================================================
+// Bytecode
+// ============================================================================
+
+struct bytecode {
+    int * code;
+    long code_length;
+
+    LispObject ** constants;
+    long constant_count;
+
+    // The analyzed lambda expressions that the bytecode makes functions
+    // from. They belong to the nodes the bytecode was compiled from.
+    struct code ** lambdas;
+    long lambda_count;
+
+    struct call_cache * caches;
+    long cache_count;
+};
+
+// The function a callee instruction found, and the env_version it found it
+// in. The function is protected from GC by its binding for as long as the
+// version is current, and isn't used after that.
+struct call_cache {
+    unsigned long version;
+    LispObject * func;
+};
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+struct bytecode * compile(struct node * node);
+
+struct bytecode * get_bytecode(struct code * code);
+
+void free_bytecode(struct bytecode * bytecode);
+
+
+#endif
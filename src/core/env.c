@@ -2,33 +2,71 @@
 // Source for the global Lisp environment.
 
 
-// The hash table implementation is adapted from K&R C, 2nd ed., pp. 143-45.
-
-
 #include <stdio.h>
 
 #include "env.h"
 #include "error.h"
 #include "builtins.h"
-#include "hash.h"
+#include "gc.h"
 #include "print.h"
+#include "trace.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// Bindings are allocated in chunks of this many.
+#define BINDING_CHUNK_SIZE 256
 
 
 // ============================================================================
 // Private function prototypes
 // ============================================================================
 
-unsigned get_index(LispObject * sym);
+struct binding * new_binding();
+
+void insert_binding(struct binding * b, unsigned hash);
+
+void grow_env();
 
-struct binding * lookup(LispObject * sym, unsigned index);
+unsigned long probe_distance(unsigned long index, unsigned hash);
 
 void print_env(bool print_indices);
 
 
+// ============================================================================
+// Private variables
+// ============================================================================
+
+// The current chunk of bindings and the number still unused at its end.
+// Chunks are never freed, because bindings are never freed.
+struct binding * binding_chunk;
+
+long binding_chunk_free;
+
+
 // ============================================================================
 // Public functions
 // ============================================================================
 
+// init_env
+// This function must be called before anything is bound.
+void init_env() {
+    env_capacity = ENV_INITIAL_CAPACITY;
+    env_count = 0;
+    env_version = 1;
+    global_env = calloc(env_capacity, sizeof(struct env_slot));
+    if (global_env == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+
+    binding_chunk = NULL;
+    binding_chunk_free = 0;
+}
+
+
 // bind
 // Bind a name to a definition.
 //
@@ -37,12 +75,11 @@ void print_env(bool print_indices);
 bool bind(LispObject * sym, LispObject * def, bool constant) {
     ASSERT(b_symbol_pred(sym));
 
-    unsigned index = get_index(sym);
-    struct binding * b = lookup(sym, index);
+    struct binding * b = sym->binding;
     if (b == NULL) {
-	b = malloc(sizeof(struct binding));
-	b->next = global_env[index];
-	global_env[index] = b;
+	b = new_binding();
+	insert_binding(b, sym->hash);
+	sym->binding = b;
     }
     else if (b->constant)
 	return false;
@@ -50,20 +87,45 @@ bool bind(LispObject * sym, LispObject * def, bool constant) {
     b->name = sym;
     b->def = def;
     b->constant = constant;
+    ++env_version;
+
+    // Minor collections don't mark the global environment.
+    write_barrier(NULL, def);
+
+    update_trace_flags(sym, def);
     return true;
 }
 
 
-// get_def
-// Return the definition bound to the given name, or NULL if the name is
-// undefined.
-LispObject * get_def(LispObject * sym) {
+// find_binding
+// Return the binding for a symbol by searching the hash table, or NULL if it
+// has never been bound. sym->binding is the same and much cheaper; this is
+// for checking the table.
+struct binding * find_binding(LispObject * sym) {
     ASSERT(b_symbol_pred(sym));
-    unsigned index = get_index(sym);
-    struct binding * b = lookup(sym, index);
-    if (b == NULL)
-	return NULL;
-    return b->def;
+
+    unsigned long mask = env_capacity - 1;
+    unsigned long index = sym->hash & mask;
+    struct env_slot * slot;
+
+    // Robin Hood insertion means the search can stop at the first entry that
+    // is closer to its home slot than sym's binding would be.
+    for (unsigned long distance = 0; ; ++distance) {
+	slot = &global_env[index];
+	if (slot->binding == NULL || probe_distance(index, slot->hash) < distance)
+	    return NULL;
+	if (slot->hash == sym->hash && slot->binding->name == sym)
+	    return slot->binding;
+	index = (index + 1) & mask;
+    }
+}
+
+
+// is_constant
+// Return whether a name is bound to a definition that can never change.
+bool is_constant(LispObject * sym) {
+    ASSERT(b_symbol_pred(sym));
+    return sym->binding != NULL && sym->binding->constant;
 }
 
 
@@ -77,24 +139,84 @@ LispObject * b_print_env(LispObject * indices) {
 // Private functions
 // ============================================================================
 
-unsigned get_index(LispObject * sym) {
-    ASSERT(b_symbol_pred(sym));
-    return hash_string(sym->print_name) % ENV_SIZE;
+// new_binding
+// Allocate an uninitialized binding.
+struct binding * new_binding() {
+    if (binding_chunk_free == 0) {
+	binding_chunk = malloc(BINDING_CHUNK_SIZE * sizeof(struct binding));
+	if (binding_chunk == NULL) {
+	    printf("\nOut of memory.\n");
+	    exit(1);
+	}
+	binding_chunk_free = BINDING_CHUNK_SIZE;
+    }
+
+    --binding_chunk_free;
+    return binding_chunk++;
 }
 
 
-// lookup
-// Return the binding for the given symbol and index, or NULL if the binding
-// does not exist.
+// insert_binding
+// Add a binding to the hash table, growing it first if needed.
 //
 // Pre:
-// - index == get_index(sym)
-struct binding * lookup(LispObject * sym, unsigned index) {
-    ASSERT(b_symbol_pred(sym));
-    for (struct binding * b = global_env[index]; b != NULL; b = b->next)
-	if (b_equal_pred(sym, b->name))
-	    return b;
-    return NULL;
+// - The table doesn't contain a binding for the same name.
+// - hash is the hash of the binding's name.
+void insert_binding(struct binding * b, unsigned hash) {
+    if ((env_count + 1) * 4 > env_capacity * 3)
+	grow_env();
+
+    unsigned long mask = env_capacity - 1;
+    unsigned long index = hash & mask;
+    unsigned long distance = 0;
+    struct env_slot entry = {b, hash};
+    struct env_slot displaced;
+
+    while (global_env[index].binding != NULL) {
+	unsigned long other = probe_distance(index, global_env[index].hash);
+	if (other < distance) {
+	    displaced = global_env[index];
+	    global_env[index] = entry;
+	    entry = displaced;
+	    distance = other;
+	}
+	index = (index + 1) & mask;
+	++distance;
+    }
+
+    global_env[index] = entry;
+    ++env_count;
+}
+
+
+// grow_env
+// Double the capacity of the hash table and reinsert every binding using its
+// cached hash.
+void grow_env() {
+    struct env_slot * old_table = global_env;
+    unsigned long old_capacity = env_capacity;
+
+    env_capacity *= 2;
+    env_count = 0;
+    global_env = calloc(env_capacity, sizeof(struct env_slot));
+    if (global_env == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+
+    for (unsigned long i = 0; i < old_capacity; ++i)
+	if (old_table[i].binding != NULL)
+	    insert_binding(old_table[i].binding, old_table[i].hash);
+
+    free(old_table);
+}
+
+
+// probe_distance
+// Return how far a slot is from the home slot of an entry with the given
+// hash.
+unsigned long probe_distance(unsigned long index, unsigned hash) {
+    return (index - hash) & (env_capacity - 1);
 }
 
 
@@ -102,18 +224,19 @@ struct binding * lookup(LispObject * sym, unsigned index) {
 // Print the global environment.
 void print_env(bool print_indices) {
     struct binding * b;
-    for (long i = 0; i < ENV_SIZE; ++i) {
-	if (print_indices && global_env[i] != NULL) {
+    for (unsigned long i = 0; i < env_capacity; ++i) {
+	b = global_env[i].binding;
+	if (b == NULL)
+	    continue;
+	if (print_indices) {
 	    printf("---\n");
-	    printf("%ld\n", i);
+	    printf("%lu\n", i);
 	    printf("---\n");
 	}
-	for (b = global_env[i]; b != NULL; b = b->next) {
-	    print_obj(b->name);
-	    printf("\n");
-	    print_obj(b->def);
-	    printf("\n");
-	    printf("\n");
-	}
+	print_obj(b->name);
+	printf("\n");
+	print_obj(b->def);
+	printf("\n");
+	printf("\n");
     }
 }
@@ -13,27 +13,68 @@
 // env
 // ============================================================================
 
-#define ENV_SIZE 101
+// A binding is made the first time its name is bound, and is never freed or
+// moved, so each symbol keeps a pointer to its own binding and looking up a
+// global doesn't need to search the hash table. Redefining a name updates its
+// binding in place.
 
 struct binding {
     LispObject * name;
     LispObject * def;
-    struct binding * next;
     bool constant;
 };
 
-struct binding * global_env[ENV_SIZE];
+// The hash table of every binding, used to find a binding by name and to
+// visit every binding. It is an open-addressing table that uses Robin Hood
+// hashing: an entry that is inserted further from its home slot than the
+// entry in its way takes that entry's slot, so no entry is ever much further
+// from its home slot than any other. Each slot caches the hash of its
+// binding's name, so probing and growing never touch the bindings. The
+// capacity is a power of two, and the table doubles before it is three
+// quarters full.
+
+#define ENV_INITIAL_CAPACITY 256
+
+struct env_slot {
+    // NULL if the slot is empty.
+    struct binding * binding;
+    unsigned hash;
+};
+
+struct env_slot * global_env;
+
+unsigned long env_capacity;
+
+unsigned long env_count;
+
+// Incremented every time bind changes a binding, so that anything cached from
+// the global environment can check that it is still valid by comparing a
+// version it saved with this one. It starts at 1, so 0 is never current.
+unsigned long env_version;
 
 
 // ============================================================================
 // Public functions
 // ============================================================================
 
+void init_env();
+
 bool bind(LispObject * sym, LispObject * def, bool constant);
 
-LispObject * get_def(LispObject * name);
+struct binding * find_binding(LispObject * sym);
+
+bool is_constant(LispObject * sym);
 
 LispObject * b_print_env(LispObject * indices);
 
 
+// get_def
+// Return the definition bound to the given symbol, or NULL if it is
+// undefined.
+static inline LispObject * get_def(LispObject * sym) {
+    struct binding * b = sym->binding;
+    return (b == NULL ? NULL : b->def);
+}
+
+
 #endif
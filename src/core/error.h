@@ -20,4 +20,14 @@
 bool typecheck(LispObject * obj, LispObject * pred_sym);
 
 
+// check_type
+// Return whether obj is of the given type, where pred_sym names the type's
+// predicate. The type is checked inline, and typecheck is only called to
+// print the error if it is wrong.
+static inline bool check_type(LispObject * obj, LispType type,
+			      LispObject * pred_sym) {
+    return get_type(obj) == type || typecheck(obj, pred_sym);
+}
+
+
 #endif
@@ -4,6 +4,8 @@
 
 #include <stdio.h>
 
+#include "ast.h"
+#include "compile.h"
 #include "env.h"
 #include "builtins.h"
 #include "eval.h"
@@ -11,24 +13,7 @@
 #include "obj.h"
 #include "print.h"
 #include "stack.h"
-
-
-// ============================================================================
-// Macros
-// ============================================================================
-
-#define EVAL_ERR "Invalid expression:\n\n  "
-
-#define INVALID_EXPR printf(EVAL_ERR); print_obj(expr); printf("\n\n");
-
-
-// ============================================================================
-// Private function prototypes
-// ============================================================================
-
-LispObject * get_new_env(LispObject * arg_names,
-			 LispObject * arg_exprs,
-			 LispObject * env_list);
+#include "vm.h"
 
 
 // ============================================================================
@@ -36,446 +21,357 @@ LispObject * get_new_env(LispObject * arg_names,
 // ============================================================================
 
 LispObject * b_eval(LispObject * expr) {
-    // Because eval does not currently check the structure of the list of local
-    // environments passed to it, directly exposing eval as a two-argument
-    // builtin function can cause bugs if the user doesn't obey eval's
-    // precondition for its second argument.
-    return eval(expr, LISP_EMPTY);
+    return eval(expr);
 }
 
 
 // eval
+// Analyze an expression and evaluate it in the global environment, either
+// with eval_node or by compiling it and running the bytecode, depending on
+// eval_use_bytecode.
 //
 // Pre:
-// - expr and env_list are protected from garbage collection.
-// - env_list is the empty list or a list of local environments, where each
-//   local env is either the empty list or a list of pairs, where each pair's
-//   car is a symbol and its cdr is the value bound to that symbol. For
-//   example, a local env in which x is bound to 1 and y to 2 could be
-//   represented as ((y . 2) (x . 1)); the order in which the (name . value)
-//   pairs are listed in a local env does not matter. However, names are
-//   lexically scoped, so when looking up a symbol, local envs will be searched
-//   in the order in which they appear in env_list; the first env listed is the
-//   innermost env and the last env listed is the outermost env.
+// - expr is protected from garbage collection.
 //
 // On error:
 // - Return NULL.
-LispObject * eval(LispObject * expr, LispObject * env_list) {
-    if (b_int_pred(expr)
-	|| b_null_pred(expr)
-	|| expr->type == TYPE_LAMBDA
-	|| is_builtin(expr))
-	return expr;
-
-    if (b_symbol_pred(expr)) {
-	// expr is a symbol, so find the value to which it's bound.
-
-	// Search env_list for expr's binding.
-	LispObject * env;
-	while (!b_null_pred(env_list)) {
-	    env = car(env_list);
-
-	    // Search env for expr's binding.
-	    LispObject * binding;
-	    while (!b_null_pred(env)) {
-		binding = car(env);
-
-		// If expr equals the name in the (name . value) pair, return
-		// the value.
-		if (b_equal_pred(car(binding), expr))
-		    return cdr(binding);
-
-		env = cdr(env);
-	    }
-	    env_list = cdr(env_list);
-	}
-
-	// env_list doesn't contain a binding for expr, so look it up in the
-	// global env.
-	LispObject * global_def = get_def(expr);
-	if (global_def == NULL) {
-	    INVALID_EXPR;
-	    print_obj(expr);
-	    printf(" is undefined\n");
-	}
-	return global_def;
-    }
-
-    if (!b_list_pred(expr)) {
-	ASSERT(b_pair_pred(expr));
-	INVALID_EXPR;
-	printf("Cannot evaluate a non-list pair\n");
+LispObject * eval(LispObject * expr) {
+    struct node * node = analyze(expr);
+    if (node == NULL)
 	return NULL;
-    }
 
-    if (b_equal_pred(car(expr), LISP_QUOTE)) {
-	if (length(cdr(expr)) != 1) {
-	    INVALID_EXPR;
-	    print_obj(LISP_QUOTE);
-	    printf(" takes 1 argument\n");
-	    return NULL;
-	}
-    	return car(cdr(expr));
+    // LISP_EMPTY is part of the initial set of objects protected from GC,
+    // so it meets eval_node's and run_bytecode's pre that env is protected
+    // from GC.
+    LispObject * result;
+    if (eval_use_bytecode) {
+	struct bytecode * bytecode = compile(node);
+	result = run_bytecode(bytecode, LISP_EMPTY);
+	free_bytecode(bytecode);
     }
+    else
+	result = eval_node(node, LISP_EMPTY);
 
-    if (b_equal_pred(car(expr), LISP_COND)) {
+    free_node(node);
+    return result;
+}
 
-	// clauses is protected from GC because cdr(expr) is reachable from
-	// expr, which is protected from GC as per eval's pre.
-	LispObject * clauses = cdr(expr);
 
-	LispObject * clause;
-	LispObject * bool_val;
-	while (!b_null_pred(clauses)) {
-	    // clauses' protection from GC protects clause from GC because
-	    // car(clauses) is reachable from clauses.
-	    clause = car(clauses);
+// eval_node
+// Evaluate an analyzed expression.
+//
+// Pre:
+// - The expression node was analyzed from, and env, are protected from
+//   garbage collection.
+// - env is the empty list if node is being evaluated in the global
+//   environment, and otherwise the frame of the innermost enclosing call.
+//   Frames are lexically scoped: the parent of a call's frame is the frame
+//   that the called function was created in.
+//
+// On error:
+// - Return NULL.
+LispObject * eval_node(struct node * node, LispObject * env) {
+    // The frame is pushed by the first function application that node, or a
+    // node that replaces it, evaluates. Its first slot protects the function
+    // applied by the last tail call, which protects the nodes of its body,
+    // and its second protects the frame that body is evaluated in.
+    long frame = 0;
+
+    LispObject * expr;
+    LispObject * result;
 
-	    if (!b_list_pred(clause)) {
-		INVALID_EXPR;
-		print_obj(clause);
-		printf(" is not a list\n");
-		return NULL;
-	    }
+    // Expressions in tail position, the result of a cond clause, the last
+    // operand of an and or an or, and the body of an applied lambda, replace
+    // node and env, so evaluating them doesn't use any more C stack or
+    // frames.
+    while (true) {
+	expr = node->expr;
+
+	switch (node->kind) {
+	case NODE_CONST:
+	    result = node->value;
+	    goto done;
+
+	case NODE_LOCAL_REF: {
+	    LispObject * var_frame = env;
+	    for (long i = 0; i < node->depth; ++i)
+		var_frame = var_frame->parent;
+	    result = frame_slots(var_frame)[node->index];
+	    goto done;
+	}
 
-	    if (length(clause) != 2) {
+	case NODE_GLOBAL_REF:
+	    result = get_def(node->sym);
+	    if (result == NULL) {
 		INVALID_EXPR;
-		print_obj(clause);
-		printf(" is not of length 2\n");
-		return NULL;
+		print_obj(expr);
+		printf(" is undefined\n");
 	    }
+	    goto done;
 
-	    // clause being protected from GC meets eval's pre that expr is
-	    // protected from GC because car(clause) is reachable from clause;
-	    // and eval's pre that env_list is protected from GC is still
-	    // true here.
-	    bool_val = eval(car(clause), env_list);
-
-	    if (bool_val == NULL)
-		return NULL;
-
-	    if (bool_val != LISP_F)
-		// clause being protected from GC meets eval's pre that expr
-		// is protected from GC because car(cdr(clause)) is reachable
-		// from clause; and eval's pre that env_list is protected
-		// from GC is still true here.
-		return eval(car(cdr(clause)), env_list);
-
-	    // The new value of clauses is still protected from GC because
-	    // cdr(clauses) is reachable from the old value of clauses.
-	    clauses = cdr(clauses);
-	}
-	return LISP_EMPTY;
-    }
+	case NODE_COND: {
+	    LispObject * bool_val = LISP_F;
+	    long i;
+	    for (i = 0; i < node->clause_count && bool_val == LISP_F; ++i) {
+		bool_val = eval_node(node->clauses[2 * i], env);
 
-    if(b_equal_pred(car(expr), LISP_DEFINE)) {
-	if (length(cdr(expr)) != 2) {
-	    INVALID_EXPR;
-	    print_obj(LISP_DEFINE);
-	    printf(" takes 2 arguments\n");
-	    return NULL;
-	}
+		if (bool_val == NULL) {
+		    result = NULL;
+		    goto done;
+		}
+	    }
 
-	LispObject * sym = car(cdr(expr));
-	if (!b_symbol_pred(sym)) {
-	    INVALID_EXPR;
-	    print_obj(sym);
-	    printf(" is not a symbol\n");
-	    return NULL;
+	    if (bool_val == LISP_F) {
+		result = LISP_EMPTY;
+		goto done;
+	    }
+
+	    // Clause i - 1's test succeeded.
+	    node = node->clauses[2 * i - 1];
+	    continue;
 	}
 
-	LispObject * def = eval(car(cdr(cdr(expr))), env_list);
-	if (def == NULL)
-	    return NULL;
+	case NODE_AND:
+	case NODE_OR: {
+	    // An and stops at the first operand that is f, and an or at the
+	    // first that isn't, and evaluates to it. Otherwise it evaluates
+	    // to its last operand, which is in tail position.
+	    bool stop_on_f = (node->kind == NODE_AND);
+	    if (node->operand_count == 0) {
+		result = (stop_on_f ? LISP_T : LISP_F);
+		goto done;
+	    }
 
-	bool success = bind(sym, def, false);
-	if (!success) {
-	    INVALID_EXPR;
-	    printf("Cannot redefine ");
-	    print_obj(sym);
-	    printf("\n");
-	}
-	return def;
-    }
+	    for (long i = 0; i < node->operand_count - 1; ++i) {
+		result = eval_node(node->operands[i], env);
+		if (result == NULL || (result == LISP_F) == stop_on_f)
+		    goto done;
+	    }
 
-    if(b_equal_pred(car(expr), LISP_LAMBDA)) {
-	if (length(cdr(expr)) != 2) {
-	    INVALID_EXPR;
-	    print_obj(LISP_LAMBDA);
-	    printf(" takes 2 arguments\n");
-	    return NULL;
+	    node = node->operands[node->operand_count - 1];
+	    continue;
 	}
 
-	LispObject * args_list = car(cdr(expr));
-	if (!b_list_pred(args_list)) {
-	    INVALID_EXPR;
-	    print_obj(args_list);
-	    printf(" is not a list\n");
-	    return NULL;
-	}
+	case NODE_NOT:
+	    result = eval_node(node->operands[0], env);
+	    if (result != NULL)
+		result = (result == LISP_F ? LISP_T : LISP_F);
+	    goto done;
 
-	// Check that all argument names are symbols.
-	while (!b_null_pred(args_list)) {
-	    if (!b_symbol_pred(car(args_list))) {
+	case NODE_DEFINE:
+	    result = eval_node(node->def, env);
+	    if (result != NULL && !bind(node->name, result, false)) {
 		INVALID_EXPR;
-		print_obj(car(args_list));
-		printf(" is not a symbol\n");
-		return NULL;
+		printf("Cannot redefine ");
+		print_obj(node->name);
+		printf("\n");
+	    }
+	    goto done;
+
+	case NODE_LAMBDA:
+	    // eval_node's pre that the expression node was analyzed from is
+	    // protected from GC meets get_lambda's pre that the lambda's
+	    // parameter list and body are protected from GC, because they are
+	    // reachable from it.
+	    result = get_lambda(node->code, env);
+	    goto done;
+
+	case NODE_CALL: {
+	    LispObject * func;
+	    bool cached = (node->cache_version == env_version);
+	    if (cached) {
+		// The binding the function came from hasn't changed, so it
+		// is still protected from GC and still accepted by check_call.
+		func = node->cached_func;
+	    }
+	    else {
+		func = eval_node(node->func, env);
+		if (func == NULL) {
+		    result = NULL;
+		    goto done;
+		}
 	    }
-	    args_list = cdr(args_list);
-	}
 
-	// Check for duplicate argument names.
-	args_list = car(cdr(expr));
-	LispObject * args_compare_list;
-	while(!b_null_pred(args_list)) {
-	    args_compare_list = cdr(args_list);
-	    while (!b_null_pred(args_compare_list)) {
-		if (b_equal_pred(car(args_list), car(args_compare_list))) {
-		    INVALID_EXPR;
-		    printf("Duplicate argument name ");
-		    print_obj(car(args_list));
-		    printf("\n");
+	    if (frame == 0) {
+		frame = push_frame(2);
+		if (frame == 0)
 		    return NULL;
-		}
-		args_compare_list = cdr(args_compare_list);
 	    }
-	    args_list = cdr(args_list);
-	}
 
-	// body is protected from GC because expr is protected from GC by
-	// eval's pre and car(cdr(cdr(expr))) is reachable from expr.
-	LispObject * body = car(cdr(cdr(expr)));
-	if (b_pair_pred(body) && !b_list_pred(body)) {
-	    INVALID_EXPR;
-	    print_obj(body);
-	    printf(" is a non-list pair\n");
-	    return NULL;
-	}
+	    // Protect func from GC that could be triggered by calls to
+	    // eval_node, call_builtin, and get_frame, below. The function in
+	    // the frame's first slot stays protected too, until the arguments,
+	    // which are part of its body, have been evaluated.
+	    push(func);
 
-	// eval's pre that expr is protected from GC meets get_lambda's pre
-	// that its first arg is protected from GC, because car(cdr(expr)) is
-	// reachable from expr; body's protection from GC meets get_lambda's
-	// pre that body is protected from GC; and eval's pre that env_list
-	// is protected from GC meets get_lambda's pre that env_list is
-	// protected from GC.
-	return get_lambda(car(cdr(expr)), body, env_list);
-    }
+	    if (!cached) {
+		if (!check_call(expr, func, node->arg_count)) {
+		    result = NULL;
+		    goto done;
+		}
+		if (node->func->kind == NODE_GLOBAL_REF) {
+		    node->cache_version = env_version;
+		    node->cached_func = func;
+		}
+	    }
 
-    // expr represents a function application.
+	    // Evaluate the arguments onto the stack, where they are protected
+	    // from GC that could be triggered by evaluating the ones after
+	    // them.
+	    for (long i = 0; i < node->arg_count; ++i) {
+		result = eval_node(node->args[i], env);
+		if (result == NULL)
+		    goto done;
+		push(result);
+	    }
 
-    LispObject * func = eval(car(expr), env_list);
+	    if (func->type != TYPE_LAMBDA) {
+		result = call_builtin(expr, func, node->arg_count);
+		goto done;
+	    }
 
-    if (func == NULL)
-	return NULL;
+	    // func is protected from GC, so it meets get_frame's pre that the
+	    // parent frame and names are protected from GC, because they are
+	    // reachable from func.
+	    env = get_frame(func->env, func->args, node->arg_count);
+
+	    // Evaluate func's body in place of node. Keeping func in the
+	    // frame meets eval_node's pre that the expression the body was
+	    // analyzed from is protected from GC, because func->body is
+	    // reachable from func.
+	    pop_n(node->arg_count + 1);
+	    stack[frame] = func;
+	    stack[frame + 1] = env;
+	    node = func->code->body_node;
+	    continue;
+	}
+	}
+	FOUND_BUG;
+    }
 
-    // Protect func from GC that could be triggered by calls to eval and/or
-    // get_new_env, below.
-    push(func);
+ done:
+    if (frame != 0)
+	pop_frame(frame);
+    return result;
+}
 
-    LispObject * result;
-    bool builtin;
 
-    if (func->type == TYPE_BUILTIN_0) {
-	builtin = true;
-	
-	if (!b_null_pred(cdr(expr))) {
+// check_call
+// Check that func is a function that can be applied to arg_count arguments.
+// Called before any of the arguments are evaluated.
+//
+// On error:
+// - Print an error message about expr, the application, and return false.
+bool check_call(LispObject * expr, LispObject * func, long arg_count) {
+    switch (get_type(func)) {
+    case TYPE_BUILTIN_0:
+	if (arg_count != 0) {
 	    INVALID_EXPR;
 	    print_obj(func);
 	    printf(" takes no arguments\n");
-	    pop();  // pop func
-	    return NULL;
+	    return false;
 	}
+	return true;
 
-	result = func->b_func_0();
-    }
-    else if (func->type == TYPE_BUILTIN_1
-	     || func->type == TYPE_BOOL_BUILTIN_1) {
-
-	builtin = true;
-
-	if (length(cdr(expr)) != 1) {
+    case TYPE_BUILTIN_1:
+    case TYPE_BOOL_BUILTIN_1:
+	if (arg_count != 1) {
 	    INVALID_EXPR;
 	    print_obj(func);
 	    printf(" takes 1 argument\n");
-	    pop();  // pop func
-	    return NULL;
+	    return false;
 	}
+	return true;
 
-	LispObject * arg1 = eval(car(cdr(expr)), env_list);
-	if (arg1 == NULL) {
-	    pop();  // pop func
-	    return NULL;
-	}
-
-	if (func->type == TYPE_BUILTIN_1)
-	    result = func->b_func_1(arg1);
-	else {
-	    ASSERT(func->type == TYPE_BOOL_BUILTIN_1);
-	    result = (func->b_bool_func_1(arg1) ? LISP_T : LISP_F);
-	}
-    }
-    else if (func->type == TYPE_BUILTIN_2
-	     || func->type == TYPE_BOOL_BUILTIN_2) {
-
-	builtin = true;
-	
-	if (length(cdr(expr)) != 2) {
+    case TYPE_BUILTIN_2:
+    case TYPE_BOOL_BUILTIN_2:
+	if (arg_count != 2) {
 	    INVALID_EXPR;
 	    print_obj(func);
 	    printf(" takes 2 arguments\n");
-	    pop();  // pop func
-	    return NULL;
-	}
-
-	LispObject * arg1 = eval(car(cdr(expr)), env_list);
-	if (arg1 == NULL) {
-	    pop();  // pop func;
-	    return NULL;
-	}
-
-	// Protect arg1 from GC that could be triggered by eval'ing the
-	// second argument.
-	push(arg1);
-
-	LispObject * arg2 = eval(car(cdr(cdr(expr))), env_list);
-
-	pop(); // pop arg1
-
-	if (arg2 == NULL) {
-	    pop();  // pop func
-	    return NULL;
+	    return false;
 	}
+	return true;
 
-	if (func->type == TYPE_BUILTIN_2)
-	    result = func->b_func_2(arg1, arg2);
-	else {
-	    ASSERT(func->type == TYPE_BOOL_BUILTIN_2);
-	    result = (func->b_bool_func_2(arg1, arg2) ? LISP_T : LISP_F);
+    case TYPE_BUILTIN_N: {
+	long min = func->min_args;
+	long max = func->max_args;
+	if (arg_count < min || (max != -1 && arg_count > max)) {
+	    INVALID_EXPR;
+	    print_obj(func);
+	    long limit = (arg_count < min ? min : max);
+	    printf(" takes %s%ld argument%s",
+		   (min == max ? "" : arg_count < min ? "at least " : "at most "),
+		   limit, (limit == 1 ? "\n" : "s\n"));
+	    return false;
 	}
+	return true;
     }
-    else
-	builtin = false;
 
-    if (builtin) {
-	pop();  // pop func
-	if (result == NULL) {
+    case TYPE_LAMBDA: {
+	long param_count = func->code->param_count;
+	if (arg_count != param_count) {
 	    INVALID_EXPR;
 	    print_obj(func);
-	    printf(" signaled an error\n");
+	    printf(" takes %ld argument%s",
+		   param_count, (param_count == 1 ? "\n" : "s\n"));
+	    return false;
 	}
-	return result;
+	return true;
     }
 
-    if (func->type != TYPE_LAMBDA) {
+    default:
 	INVALID_EXPR;
 	print_obj(func);
 	printf(" is not a function\n");
-	pop();  // pop func
-	return NULL;
+	return false;
     }
-
-    // func is protected from GC, so it meets get_new_env's pre that arg_names
-    // is protected from GC, because func->args is reachable from func; and
-    // eval's pre that expr is protected from GC meets get_new_env's pre that
-    // arg_exprs is protected from GC, because cdr(expr) is reachable from
-    // expr.
-    LispObject * arg_names = func->args;
-    LispObject * arg_exprs = cdr(expr);
-
-    long len_arg_names = length(arg_names);
-    if (length(arg_exprs) != len_arg_names) {
-	INVALID_EXPR;
-	print_obj(func);
-	printf(" takes %ld argument%s",
-	       len_arg_names, (len_arg_names == 1 ? "\n" : "s\n"));
-	pop();  // pop func
-	return NULL;
-    }
-
-    // eval's pre that env_list is protected from GC meets get_new_env's pre
-    // that env_list is protected from GC.
-    LispObject * new_env = get_new_env(arg_names, arg_exprs, env_list);
-    if (new_env == NULL) {
-	pop();  // pop func
-	return NULL;
-    }
-
-    LispObject * new_env_list = b_cons(new_env, func->env_list);
-
-    // Meet eval's pre that env_list is protected from GC.
-    push(new_env_list);
-
-    // func is protected from GC, so it meets eval's pre that expr is
-    // protected from GC, because func->body is reachable from func.
-    result = eval(func->body, new_env_list);
-
-    pop();  // pop new_env_list
-    pop();  // pop func
-
-    return result;
-
-    FOUND_BUG;
 }
 
 
-// ============================================================================
-// Private functions
-// ============================================================================
-
-// get_new_env
-// Get a local environment.
-//
-// Given a list of argument names and a list of expressions, evaluate each
-// expression and bind its value to the corresponding name. Return a local
-// environment of the form required by eval's pre.
+// call_builtin
+// Apply a builtin function to its arguments, which are the top arg_count
+// objects on the stack, in the order they were pushed. The arguments are left
+// on the stack, where they stay protected from GC that could be triggered by
+// the builtin.
 //
 // Pre:
-// - arg_names, arg_exprs, and env_list are protected from garbage collection.
-// - arg_names is the empty list or a list of symbols.
-// - env_list is the current list of local environments, of the same form as
-//   described by eval's pre.
+// - check_call(expr, func, the number of arguments) returned true.
 //
 // On error:
-// - Return NULL.
-LispObject * get_new_env(LispObject * arg_names,
-			 LispObject * arg_exprs,
-			 LispObject * env_list)
-{
-    ASSERT(length(arg_exprs) == length(arg_names));
-
-    LispObject * new_env = LISP_EMPTY;
-    LispObject * binding;
-    LispObject * arg_val;
-
-    while (!b_null_pred(arg_names)) {
-
-	// Protect new_env from GC that could be triggered by eval or b_cons.
-	push(new_env);
-
-	// get_new_env's pre that arg_exprs is protected from GC meets eval's
-	// pre that its first arg is protected from GC, because
-	// car(arg_exprs) is reachable from arg_exprs; and get_new_env's pre
-	// that env_list is protected from GC meets eval's pre that env_list
-	// is protected from GC.
-	arg_val = eval(car(arg_exprs), env_list);
-
-	if (arg_val == NULL) {
-	    pop();  // pop new_env
-	    return NULL;
-	}
-
-	// Construct a (name . value) pair.
-	binding = b_cons(car(arg_names), arg_val);
-
-	pop();  // pop new_env
-
-	new_env = b_cons(binding, new_env);
+// - Print an error message about expr, the application, and return NULL.
+LispObject * call_builtin(LispObject * expr, LispObject * func,
+			  long arg_count) {
+    LispObject * result;
 
-	arg_names = cdr(arg_names);
-	arg_exprs = cdr(arg_exprs);
+    switch (func->type) {
+    case TYPE_BUILTIN_0:
+	result = func->b_func_0();
+	break;
+    case TYPE_BUILTIN_1:
+	result = func->b_func_1(stack[stack_ptr]);
+	break;
+    case TYPE_BOOL_BUILTIN_1:
+	result = (func->b_bool_func_1(stack[stack_ptr]) ? LISP_T : LISP_F);
+	break;
+    case TYPE_BUILTIN_2:
+	result = func->b_func_2(stack[stack_ptr - 1], stack[stack_ptr]);
+	break;
+    case TYPE_BOOL_BUILTIN_2:
+	result = (func->b_bool_func_2(stack[stack_ptr - 1], stack[stack_ptr])
+		  ? LISP_T : LISP_F);
+	break;
+    case TYPE_BUILTIN_N:
+	result = func->b_func_n(stack_ptr - arg_count + 1, arg_count);
+	break;
+    default:
+	FOUND_BUG;
     }
 
-    return new_env;
+    if (result == NULL) {
+	INVALID_EXPR;
+	print_obj(func);
+	printf(" signaled an error\n");
+    }
+    return result;
 }
-
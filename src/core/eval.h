@@ -6,12 +6,43 @@
 #define EVAL_H
 
 
+#include "ast.h"
 #include "obj.h"
 
 
+// ============================================================================
+// Macros
+// ============================================================================
+
+#define EVAL_ERR "Invalid expression:\n\n  "
+
+#define INVALID_EXPR printf(EVAL_ERR); print_obj(expr); printf("\n\n");
+
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// Whether eval compiles expressions to bytecode and runs them in the virtual
+// machine, rather than evaluating them with eval_node. parse_eval sets it
+// from use-bytecode.
+bool eval_use_bytecode;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
 LispObject * b_eval(LispObject * expr);
 
-LispObject * eval(LispObject * expr, LispObject * env);
+LispObject * eval(LispObject * expr);
+
+LispObject * eval_node(struct node * node, LispObject * env);
+
+bool check_call(LispObject * expr, LispObject * func, long arg_count);
+
+LispObject * call_builtin(LispObject * expr, LispObject * func,
+			  long arg_count);
 
 
 #endif
@@ -10,12 +10,77 @@
 
 
 #include <stdio.h>
+#include <time.h>
 
+#include "ast.h"
 #include "env.h"
 #include "gc.h"
 #include "error.h"
+#include "heap.h"
+#include "intern.h"
+#include "parallel-mark.h"
 #include "print.h"
 #include "stack.h"
+#include "trace.h"
+
+
+// ============================================================================
+// Private variables
+// ============================================================================
+
+// Whether the current collection is a minor collection.
+bool minor_collection;
+
+// The remembered set: young objects that are referenced from the old
+// generation or from the global environment, which minor collections don't
+// mark. Filled in by write_barrier and emptied after every collection.
+LispObject ** remembered;
+
+long remembered_count;
+
+long remembered_capacity;
+
+// Gray objects: objects waiting to be scanned.
+LispObject ** mark_stack;
+
+long mark_stack_count;
+
+long mark_stack_capacity;
+
+// The pause budget of the current incremental collection, in nanoseconds.
+long pause_budget_ns;
+
+// An incremental collection does its next slice of work when
+// heap_allocated_bytes reaches next_step.
+unsigned long next_step;
+
+// The next page to be swept by an incremental collection, and the size class
+// it belongs to.
+struct page * sweep_cursor;
+
+int sweep_class;
+
+// The total pause time of the current incremental marking.
+unsigned long incremental_pause_us;
+
+// The objects marked so far by the current full collection: how many, how
+// many bytes they take up, and how many of each type. Counted as objects are
+// marked, so that the heap doesn't have to be walked to count them once
+// marking is done.
+unsigned long marked_objs;
+
+unsigned long marked_bytes;
+
+unsigned long marked_by_type[NUM_LISP_TYPES];
+
+// How long recent minor collections took per kilobyte of young objects, in
+// nanoseconds, or 0 before the first minor collection.
+unsigned long minor_ns_per_kb;
+
+// The log file that gc-log names, and the name it was opened with.
+FILE * log_file;
+
+char * log_name;
 
 
 // ============================================================================
@@ -24,13 +89,59 @@
 
 void mark();
 
-void mark_obj(LispObject * obj);
+void mark_nursery_roots();
+
+void push_roots();
+
+void push_stack_roots();
+
+bool drain_mark_stack(long deadline);
 
-void sweep();
+LispObject * scan_obj(LispObject * obj);
+
+void push_mark_stack(LispObject * obj);
+
+void mark_heap();
+
+void start_sweep();
+
+void reset_survivors();
+
+void count_survivor(LispObject * obj);
+
+void count_survivors();
+
+void sweep_nursery();
+
+void sweep_young_objs(struct page * page);
 
 void free_obj(LispObject * obj);
 
-bool gc_output();
+void update_heap_limit(unsigned long live_bytes);
+
+void update_nursery_limit();
+
+void remember(LispObject * obj);
+
+void keep_young_remembered();
+
+void start_incremental();
+
+void gc_step(long start);
+
+bool sweep_slice(long deadline);
+
+void finish_sweep();
+
+long now_ns();
+
+unsigned long record_pause(long start_ns, GCPauseKind kind);
+
+void log_collection(char * kind, unsigned long pause_us);
+
+void push_stat(char * name, unsigned long value);
+
+int gc_threads();
 
 
 // ============================================================================
@@ -38,166 +149,868 @@ bool gc_output();
 // ============================================================================
 
 // mark
-// Mark the initial set of objects and objects reachable from the global
-// environment or the stack.
+// Mark the initial set of objects, interned symbols, and objects reachable
+// from the global environment or the stack, using gc-threads threads.
 void mark() {
-    mark_obj(LISP_EMPTY);
-
-    mark_obj(LISP_QUOTE);
-    mark_obj(LISP_COND);
-    mark_obj(LISP_DEFINE);
-    mark_obj(LISP_LAMBDA);
-
-    // TODO: once object interning is implemented, we won't have to mark these,
-    // because they are symbols that are bound to values in the global
-    // environment. Currently, the only reason we have to mark them is that
-    // they may be redefined, in which case a new symbol object with the same
-    // name is created and used in the binding, which means the original symbol
-    // is no longer part of the global env and can be GC'd.
-    mark_obj(LISP_GC_OUTPUT);
-    mark_obj(LISP_STACK_OUTPUT);
-    mark_obj(LISP_T);
-    mark_obj(LISP_F);
-
-    // TODO: and these aren't actually bound in the global environment, but
-    // after object interning, they will be (see how these are used in
-    // make_initial_objs)
-    mark_obj(LISP_PAIR_PRED_SYM);
-    mark_obj(LISP_LIST_PRED_SYM);
-    mark_obj(LISP_INT_PRED_SYM);
-
-    struct binding * b;
-    for (long i = 0; i < ENV_SIZE; ++i) {
-	for (b = global_env[i]; b != NULL; b = b->next) {
-	    mark_obj(b->name);
-	    mark_obj(b->def);
-	}
+    reset_survivors();
+    push_roots();
+
+    int threads = gc_threads();
+    if (threads > 1) {
+	parallel_mark(mark_stack, mark_stack_count, threads);
+	mark_stack_count = 0;
+	count_survivors();
     }
+    else
+	drain_mark_stack(0);
+}
+
+
+// mark_nursery_roots
+// Mark the young objects that are reachable from the stack or from the
+// remembered set. Old objects aren't traced, so this only visits young
+// objects.
+void mark_nursery_roots() {
+    push_mark_stack(LISP_EMPTY);
 
+    for (long i = 0; i < remembered_count; ++i)
+	push_mark_stack(remembered[i]);
+
+    push_stack_roots();
+    drain_mark_stack(0);
+}
+
+
+// push_roots
+// Push the initial set of objects, interned symbols, the definitions in the
+// global environment, and the stack onto the mark stack.
+void push_roots() {
+    push_mark_stack(LISP_EMPTY);
+
+    // Interned symbols are never freed. This also protects the symbols in the
+    // initial set of objects, such as LISP_QUOTE.
+    LispObject * sym;
+    for (unsigned long i = 0; i < intern_size; ++i)
+	for (sym = intern_table[i]; sym != NULL; sym = sym->intern_next)
+	    push_mark_stack(sym);
+
+    // Every name in the global environment is an interned symbol, so only the
+    // definitions need to be marked.
+    for (unsigned long i = 0; i < env_capacity; ++i)
+	if (global_env[i].binding != NULL)
+	    push_mark_stack(global_env[i].binding->def);
+
+    push_stack_roots();
+}
+
+
+void push_stack_roots() {
     for (long i = stack_ptr; i > 0; --i)
-	mark_obj(stack[i]);
+	push_mark_stack(stack[i]);
 }
 
 
-// mark_obj
-// Mark an object as reachable.
-void mark_obj(LispObject * obj) {
-    // Don't mark obj if it's already marked. Without this check, marking
-    // recurses infinitely if there are any circular references reachable from
+// drain_mark_stack
+// Scan gray objects until the mark stack is empty or the deadline (a value
+// of now_ns) has passed. A deadline of 0 means no deadline. Return whether
+// the mark stack is empty.
+//
+// Marking doesn't recurse. Objects that still have to be scanned are kept on
+// the mark stack, and a chain of cdrs is followed in a loop without using the
+// mark stack at all, so marking a long list takes constant C stack space and
+// visits the list's pairs in order.
+bool drain_mark_stack(long deadline) {
+    LispObject * obj;
+    long scanned = 0;
+    while (mark_stack_count > 0) {
+	--mark_stack_count;
+	obj = mark_stack[mark_stack_count];
+	while (obj != NULL) {
+	    obj = scan_obj(obj);
+	    ++scanned;
+
+	    // Checking the time is relatively slow, so only check it every
+	    // so often. An unfinished cdr chain goes back on the mark stack.
+	    if (deadline != 0 && scanned % 256 == 0 && now_ns() >= deadline) {
+		if (obj != NULL)
+		    push_mark_stack(obj);
+		return mark_stack_count == 0;
+	    }
+	}
+    }
+    return true;
+}
+
+
+// scan_obj
+// Mark an object if it isn't marked yet and push the objects it refers to
+// onto the mark stack, except for one, which is returned so the caller can
+// scan it next. Return NULL if there is nothing to scan next.
+LispObject * scan_obj(LispObject * obj) {
+    // Tagged ints aren't heap objects.
+    if (is_fixnum(obj))
+	return NULL;
+
+    // A minor collection treats every old object as marked.
+    if (minor_collection && !is_young(obj))
+	return NULL;
+
+    // Don't scan obj if it's already marked. Without this check, marking
+    // never terminates if there are any circular references reachable from
     // obj; for example, if obj is a pair and the cdr of obj is obj.
-    if (!obj->marked) {
+    if (is_marked(obj))
+	return NULL;
+
+    TRACE(trace_gc, TRACE_MARK, obj, 0);
+    set_marked(obj);
+    if (!minor_collection)
+	count_survivor(obj);
+
+    if (b_pair_pred(obj)) {
+	push_mark_stack(obj->car);
+	return obj->cdr;
+    }
+    if (obj->type == TYPE_LAMBDA) {
+	push_mark_stack(obj->args);
+	push_mark_stack(obj->body);
+	return obj->env;
+    }
+    if (obj->type == TYPE_FRAME) {
+	push_mark_stack(obj->names);
+	for (long i = 0; i < obj->slot_count; ++i)
+	    push_mark_stack(frame_slots(obj)[i]);
+	return obj->parent;
+    }
+    if (is_builtin(obj))
+	return obj->builtin_name;
+    return NULL;
+}
+
 
-	if (gc_output()) {
-	    printf("mark: ");
-	    print_obj(obj);
-	    printf("\n");
+// push_mark_stack
+// Push an object that has to be scanned onto the mark stack, growing the
+// mark stack if it is full.
+void push_mark_stack(LispObject * obj) {
+    // Tagged ints aren't heap objects.
+    if (is_fixnum(obj))
+	return;
+
+    if (mark_stack_count == mark_stack_capacity) {
+	mark_stack_capacity = (mark_stack_capacity == 0
+			       ? 1024 : mark_stack_capacity * 2);
+	mark_stack = realloc(mark_stack,
+			     mark_stack_capacity * sizeof(LispObject *));
+	if (mark_stack == NULL) {
+	    printf("\nOut of memory.\n");
+	    exit(1);
 	}
+    }
+    mark_stack[mark_stack_count] = obj;
+    ++mark_stack_count;
+}
+
+
+// mark_heap
+// Mark the whole heap while the program is stopped, and then start sweeping.
+// If an incremental collection is in progress, it is abandoned or finished
+// first.
+void mark_heap() {
+    if (gc_phase == GC_MARKING) {
+	// Abandon the incremental collection. Some objects are black but
+	// their children may not be marked yet, so every mark bit has to be
+	// cleared before marking from scratch.
+	for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+	    for (struct page * page = size_classes[c].pages; page != NULL;
+		 page = page->next)
+		for (long i = 0; i < HEAP_BITMAP_WORDS; ++i)
+		    page->marks->mark_bits[i] = 0;
+	mark_stack_count = 0;
+	gc_phase = GC_IDLE;
+    }
+    else if (gc_phase == GC_SWEEPING) {
+	sweep_slice(0);
+	finish_sweep();
+    }
+
+    ++gc_stats.full_collections;
+    TRACE(trace_gc, TRACE_GC_START, NULL, 0);
+    mark();
+    start_sweep();
+}
+
+
+// start_sweep
+// Start sweeping once marking is done, record the survivors in gc_stats, and
+// set the heap limit for the next collection. Pages aren't swept right away:
+// heap_alloc sweeps a page before it allocates from it, and sweep_slice sweeps
+// the rest.
+void start_sweep() {
+    // Every page that exists now has to be swept. Pages created while
+    // sweeping only contain objects allocated after marking finished.
+    ++heap_sweep_epoch;
+
+    sweep_class = 0;
+    sweep_cursor = size_classes[0].pages;
+    gc_phase = GC_SWEEPING;
+    TRACE(trace_gc, TRACE_SWEEP_START, NULL, 0);
+
+    // Sweeping a page frees or promotes every young object in it, so the
+    // nursery and the remembered set start out empty. Minor collections
+    // while sweeping only see objects allocated since.
+    reset_nursery();
+    remembered_count = 0;
+
+    gc_stats.full_survivors = marked_objs;
+    gc_stats.full_survivor_bytes = marked_bytes;
+    for (int t = 0; t < NUM_LISP_TYPES; ++t)
+	gc_stats.live_objects[t] = marked_by_type[t];
+
+    // heap_bytes still counts the unmarked objects, which haven't been freed
+    // yet.
+    update_heap_limit(marked_bytes);
+}
 
-	obj->marked = true;
 
-	if (b_pair_pred(obj)) {
-	    mark_obj(car(obj));
-	    mark_obj(cdr(obj));
+// reset_survivors
+// Reset the counts of marked objects at the start of a full collection.
+void reset_survivors() {
+    marked_objs = 0;
+    marked_bytes = 0;
+    for (int t = 0; t < NUM_LISP_TYPES; ++t)
+	marked_by_type[t] = 0;
+}
+
+
+// count_survivor
+// Add an object that the current full collection has just marked to the
+// counts of marked objects.
+void count_survivor(LispObject * obj) {
+    ++marked_objs;
+    marked_bytes += obj_page(obj)->slot_size;
+    ++marked_by_type[obj->type];
+}
+
+
+// count_survivors
+// Count the marked objects by walking the heap. Parallel marking doesn't
+// count objects as it marks them, so this is done once it has finished.
+void count_survivors() {
+    unsigned long marked;
+    uint64_t bits;
+
+    reset_survivors();
+
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+	for (struct page * page = size_classes[c].pages; page != NULL;
+	     page = page->next) {
+	    marked = 0;
+	    for (long i = 0; i < HEAP_BITMAP_WORDS; ++i) {
+		bits = page->marks->mark_bits[i];
+		marked += __builtin_popcountll(bits);
+
+		// Pairs, symbols, lambdas, and frames each have size classes of
+		// their own, so only the other objects have to be looked at.
+		if (c != SIZE_CLASS_PAIR && c != SIZE_CLASS_SYM
+		    && c != SIZE_CLASS_LAMBDA && c < SIZE_CLASS_FRAME) {
+		    for (; bits != 0; bits &= bits - 1)
+			++marked_by_type[
+			    slot_obj(page, i * 64 + __builtin_ctzll(bits))->type];
+		}
+	    }
+	    marked_objs += marked;
+	    marked_bytes += marked * page->slot_size;
+
+	    if (c == SIZE_CLASS_PAIR)
+		marked_by_type[TYPE_PAIR] += marked;
+	    else if (c == SIZE_CLASS_SYM)
+		marked_by_type[TYPE_SYM] += marked;
+	    else if (c == SIZE_CLASS_LAMBDA)
+		marked_by_type[TYPE_LAMBDA] += marked;
+	    else if (c >= SIZE_CLASS_FRAME)
+		marked_by_type[TYPE_FRAME] += marked;
 	}
-	else if (obj->type == TYPE_LAMBDA) {
-	    mark_obj(obj->args);
-	    mark_obj(obj->body);
-	    mark_obj(obj->env_list);
+    }
+}
+
+
+// sweep_nursery
+// Sweep the young objects in the nursery pages, freeing unmarked ones and
+// promoting marked ones to the old generation. Pages left empty are released.
+void sweep_nursery() {
+    struct page * page = nursery_pages;
+    struct page * next;
+
+    nursery_pages = NULL;
+    nursery_bytes = 0;
+
+    while (page != NULL) {
+	next = page->nursery_next;
+	page->in_nursery = false;
+
+	// Objects are only allocated in pages that have been swept.
+	ASSERT(!page_needs_sweep(page));
+
+	sweep_young_objs(page);
+	if (page->live == 0) {
+	    // An incremental sweep may be part way through this page's size
+	    // class.
+	    if (sweep_cursor == page)
+		sweep_cursor = page->next;
+	    release_page(page);
 	}
-	else if (is_builtin(obj))
-	    mark_obj(obj->builtin_name);
+
+	page = next;
     }
+
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+	size_classes[c].alloc_page = size_classes[c].pages;
 }
 
 
-// sweep
-// Sweep the weak references, freeing unmarked objects and unmarking marked
-// objects.
-void sweep() {
-    LispObject * temp;
-
-    // Pop the head off the weak refs list until the list is empty or the head
-    // is marked.
-    while (weakrefs_head != NULL && !weakrefs_head->marked) {
-	temp = weakrefs_head->weakref;
-	free_obj(weakrefs_head);
-	weakrefs_head = temp;
-    }
-
-    // If the weak refs list is not empty, unmark the head and then iterate
-    // through the remaining items.
-    if (weakrefs_head != NULL) {
-	weakrefs_head->marked = false;
-
-	LispObject * current = weakrefs_head;
-	while (current->weakref != NULL) {
-	    if (!current->weakref->marked) {  // Free unmarked object.
-		temp = current->weakref->weakref;
-		free_obj(current->weakref);
-		current->weakref = temp;
-	    }
-	    else {  // Unmark marked object.
-		current = current->weakref;
-		current->marked = false;
-	    }
+// sweep_young_objs
+// Free the unmarked young objects in a page and promote the marked ones.
+//
+// Pre:
+// - Only young objects are marked, as after mark_nursery_roots.
+void sweep_young_objs(struct page * page) {
+    uint64_t dead;
+    unsigned long survivors;
+    LispObject * obj;
+    for (long i = 0; i < HEAP_BITMAP_WORDS; ++i) {
+	dead = page->young_bits[i] & ~page->marks->mark_bits[i];
+	while (dead != 0) {
+	    obj = slot_obj(page, i * 64 + __builtin_ctzll(dead));
+	    free_obj(obj);
+	    *(LispObject **) obj = page->free_list;
+	    page->free_list = obj;
+	    dead &= dead - 1;
 	}
+	page->alloc_bits[i] &= ~(page->young_bits[i] & ~page->marks->mark_bits[i]);
+
+	survivors = __builtin_popcountll(page->young_bits[i]
+					 & page->marks->mark_bits[i]);
+	gc_stats.minor_survivors += survivors;
+	gc_stats.minor_survivor_bytes += survivors * page->slot_size;
+
+	page->marks->mark_bits[i] = 0;
+	page->young_bits[i] = 0;
     }
 }
 
 
 // free_obj
 // Free a Lisp object.
+//
+// Pre:
+// - obj's slot is cleared in its page's alloc bitmap and added to its page's
+//   free list by the caller.
 void free_obj(LispObject * obj) {
-    ASSERT(weakrefs_count > 0);
+    ASSERT(heap_object_count > 0);
+
+    TRACE(trace_gc, TRACE_FREE, obj, 0);
+
+    // Symbols are never freed, so obj's print name (if any) doesn't need to
+    // be freed from the intern table's name arena.
+    ASSERT(!b_symbol_pred(obj));
+
+    if (obj->type == TYPE_LAMBDA)
+	release_code(obj->code);
+
+    --obj_page(obj)->live;
+    --heap_object_count;
+    heap_bytes -= obj_page(obj)->slot_size;
+}
+
+
+// update_heap_limit
+// Set the heap limit for the next collection based on the number of bytes
+// that survived this one.
+void update_heap_limit(unsigned long live_bytes) {
+    long growth_factor = get_config_int(LISP_GC_GROWTH_FACTOR,
+					GC_DEFAULT_GROWTH_FACTOR);
+    if (growth_factor < 100)
+	growth_factor = GC_DEFAULT_GROWTH_FACTOR;
+
+    long min_heap = get_config_int(LISP_GC_MIN_HEAP, GC_DEFAULT_MIN_HEAP);
+    if (min_heap < 0)
+	min_heap = GC_DEFAULT_MIN_HEAP;
+
+    // Divide first so that large heaps don't overflow.
+    unsigned long limit = live_bytes / 100 * growth_factor;
+    gc_heap_limit = (limit > (unsigned long) min_heap
+		     ? limit : (unsigned long) min_heap);
+}
+
+
+// update_nursery_limit
+// Set the number of bytes of young objects that triggers the next minor
+// collection. If gc-pause-budget is set, this is capped so that the next
+// minor collection fits in the budget; see GC_MIN_NURSERY_SIZE.
+void update_nursery_limit() {
+    long nursery_size = get_config_int(LISP_GC_NURSERY_SIZE,
+				       GC_DEFAULT_NURSERY_SIZE);
+    if (nursery_size < 0)
+	nursery_size = GC_DEFAULT_NURSERY_SIZE;
+    gc_nursery_limit = nursery_size;
+
+    long budget_us = get_config_int(LISP_GC_PAUSE_BUDGET, 0);
+    if (budget_us > 0 && minor_ns_per_kb > 0) {
+	unsigned long limit = (unsigned long) budget_us * 1000 / 2
+	    / minor_ns_per_kb * 1024;
+	if (limit < GC_MIN_NURSERY_SIZE)
+	    limit = GC_MIN_NURSERY_SIZE;
+	if (limit < gc_nursery_limit)
+	    gc_nursery_limit = limit;
+    }
+}
+
+
+// remember
+// Add an object to the remembered set.
+void remember(LispObject * obj) {
+    if (remembered_count == remembered_capacity) {
+	remembered_capacity = (remembered_capacity == 0
+			       ? 64 : remembered_capacity * 2);
+	remembered = realloc(remembered,
+			     remembered_capacity * sizeof(LispObject *));
+	if (remembered == NULL) {
+	    printf("\nOut of memory.\n");
+	    exit(1);
+	}
+    }
+    remembered[remembered_count] = obj;
+    ++remembered_count;
+}
+
+
+// keep_young_remembered
+// Remove the objects that are no longer young from the remembered set.
+void keep_young_remembered() {
+    long kept = 0;
+    for (long i = 0; i < remembered_count; ++i)
+	if (is_young(remembered[i]))
+	    remembered[kept++] = remembered[i];
+    remembered_count = kept;
+}
+
+
+// start_incremental
+// Start an incremental collection by pushing the roots onto the mark stack.
+// Marking and sweeping are done later, in slices, by gc_step. The caller
+// counts this as part of the first slice's pause.
+void start_incremental() {
+    ++gc_stats.full_collections;
+    TRACE(trace_gc, TRACE_GC_START, NULL, 0);
+    incremental_pause_us = 0;
+    gc_phase = GC_MARKING;
+    reset_survivors();
+    push_roots();
+    next_step = heap_allocated_bytes;
+}
+
+
+// gc_step
+// Do one slice of incremental marking or of sweeping, ending about
+// pause_budget_ns nanoseconds after start, the value of now_ns when the pause
+// began.
+void gc_step(long start) {
+    long deadline = start + pause_budget_ns;
+    bool marking = (gc_phase == GC_MARKING);
+
+    if (gc_phase == GC_MARKING && drain_mark_stack(deadline)) {
+	// The stack isn't covered by the write barrier, so rescan it before
+	// deciding that marking is done.
+	push_stack_roots();
+	if (drain_mark_stack(deadline))
+	    start_sweep();
+    }
+
+    if (gc_phase == GC_SWEEPING && sweep_slice(deadline))
+	finish_sweep();
+
+    next_step = heap_allocated_bytes + GC_STEP_BYTES;
+    unsigned long pause_us = record_pause(start, GC_PAUSE_SLICE);
+
+    if (marking) {
+	incremental_pause_us += pause_us;
+	if (gc_phase != GC_MARKING)
+	    log_collection("incremental", incremental_pause_us);
+    }
+}
+
+
+// sweep_slice
+// Sweep pages until every page has been swept or the deadline has passed.
+// Return whether every page has been swept. The deadline is checked before
+// each page that has to be swept, so a slice whose marking used up its budget
+// doesn't sweep any.
+bool sweep_slice(long deadline) {
+    struct page * page;
+    while (true) {
+	while (sweep_cursor == NULL) {
+	    ++sweep_class;
+	    if (sweep_class == NUM_SIZE_CLASSES)
+		return true;
+	    sweep_cursor = size_classes[sweep_class].pages;
+	}
+
+	page = sweep_cursor;
+	if (page_needs_sweep(page)) {
+	    if (deadline != 0 && now_ns() >= deadline)
+		return false;
+	    sweep_cursor = page->next;
+	    sweep_page(page);
+	    if (page->live == 0)
+		release_page(page);
+	}
+	else
+	    sweep_cursor = page->next;
+    }
+}
+
+
+// finish_sweep
+// End the current full collection once every page has been swept.
+void finish_sweep() {
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+	size_classes[c].alloc_page = size_classes[c].pages;
+
+    // Objects allocated while sweeping are still young, and the global
+    // environment may have been made to point at them.
+    keep_young_remembered();
+
+    gc_phase = GC_IDLE;
+    update_nursery_limit();
+    TRACE(trace_gc, TRACE_GC_END, NULL, 0);
+}
+
 
-    if (gc_output()) {
-	printf("free: ");
-	print_obj(obj);
-	printf("\n");
+long now_ns() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+
+// record_pause
+// Add the time since start_ns to the histogram of the given kind of pause
+// and to the pause statistics, and return it in microseconds.
+unsigned long record_pause(long start_ns, GCPauseKind kind) {
+    unsigned long us = (now_ns() - start_ns) / 1000;
+
+    int bucket = 0;
+    while (bucket < GC_PAUSE_BUCKETS - 1 && us >= (1UL << bucket))
+	++bucket;
+    ++gc_pause_histogram[kind][bucket];
+    if (us > gc_max_pause_us[kind])
+	gc_max_pause_us[kind] = us;
+
+    gc_stats.total_pause_us += us;
+    if (us > gc_stats.max_pause_us)
+	gc_stats.max_pause_us = us;
+    return us;
+}
+
+
+// log_collection
+// If gc-log is set, append a line describing the collection that just
+// finished marking to the file it names.
+void log_collection(char * kind, unsigned long pause_us) {
+    char * name = get_config_name(LISP_GC_LOG);
+    if (name != log_name) {
+	if (log_file != NULL)
+	    fclose(log_file);
+	log_file = NULL;
+	log_name = name;
+
+	// Symbols are never freed, so log_name stays valid.
+	if (name != NULL) {
+	    log_file = fopen(name, "a");
+	    if (log_file == NULL)
+		printf("\nCould not open GC log file %s.\n", name);
+	}
     }
+    if (log_file == NULL)
+	return;
+
+    bool minor = (kind[0] == 'm');
+    fprintf(log_file,
+	    "kind=%s collection=%lu pause_us=%lu survivors=%lu"
+	    " survivor_bytes=%lu heap_bytes=%lu heap_limit=%lu"
+	    " allocated_bytes=%lu allocated_objects=%lu peak_heap_bytes=%lu\n",
+	    kind,
+	    (minor ? gc_stats.minor_collections : gc_stats.full_collections),
+	    pause_us,
+	    (minor ? gc_stats.minor_survivors : gc_stats.full_survivors),
+	    (minor ? gc_stats.minor_survivor_bytes
+	     : gc_stats.full_survivor_bytes),
+	    heap_bytes, gc_heap_limit, heap_allocated_bytes,
+	    heap_allocated_objects, heap_peak_bytes);
+    fflush(log_file);
+}
 
-    if (b_symbol_pred(obj))
-	free(obj->print_name);
 
-    free(obj);
-    --weakrefs_count;
+// push_stat
+// Add a (name value) list to the front of the list on top of the stack.
+void push_stat(char * name, unsigned long value) {
+    // Symbols are never freed, so sym doesn't have to be protected.
+    LispObject * sym = get_sym(name);
+    LispObject * entry = b_cons(get_int(value), LISP_EMPTY);
+    entry = b_cons(sym, entry);
+    stack[stack_ptr] = b_cons(entry, stack[stack_ptr]);
 }
 
 
-bool gc_output() {
-    return get_config_bool(LISP_GC_OUTPUT);
+// gc_threads
+// Return the number of threads that full collections mark with.
+int gc_threads() {
+    long threads = get_config_int(LISP_GC_THREADS, 1);
+    if (threads < 1)
+	return 1;
+    return (threads > GC_MAX_THREADS ? GC_MAX_THREADS : threads);
 }
-	
+
 
 // ============================================================================
 // Public functions
 // ============================================================================
 
+// init_gc
+// This function must be called before any object is constructed.
+void init_gc() {
+    gc_heap_limit = GC_DEFAULT_MIN_HEAP;
+    gc_nursery_limit = GC_DEFAULT_NURSERY_SIZE;
+
+    minor_collection = false;
+    remembered = NULL;
+    remembered_count = 0;
+    remembered_capacity = 0;
+
+    mark_stack = NULL;
+    mark_stack_count = 0;
+    mark_stack_capacity = 0;
+
+    gc_phase = GC_IDLE;
+    minor_ns_per_kb = 0;
+    for (int k = 0; k < GC_PAUSE_KINDS; ++k) {
+	for (int i = 0; i < GC_PAUSE_BUCKETS; ++i)
+	    gc_pause_histogram[k][i] = 0;
+	gc_max_pause_us[k] = 0;
+    }
+
+    gc_stats = (struct gc_stats) {0};
+    log_file = NULL;
+    log_name = NULL;
+}
+
+
+// maybe_collect_garbage
+// Collect garbage if the collection policy calls for it. Called by get_obj
+// before each allocation.
+void maybe_collect_garbage() {
+    if (gc_phase != GC_IDLE) {
+	if (heap_allocated_bytes >= next_step)
+	    gc_step(now_ns());
+    }
+    else if (heap_bytes >= gc_heap_limit) {
+	long start = now_ns();
+	long budget_us = get_config_int(LISP_GC_PAUSE_BUDGET, 0);
+	if (budget_us > 0) {
+	    pause_budget_ns = budget_us * 1000;
+	    start_incremental();
+	    gc_step(start);
+	}
+	else {
+	    // Only marking stops the program. Sweeping is done lazily.
+	    pause_budget_ns = GC_SWEEP_SLICE_US * 1000;
+	    mark_heap();
+	    next_step = heap_allocated_bytes + GC_STEP_BYTES;
+	    log_collection("full", record_pause(start, GC_PAUSE_FULL));
+	}
+    }
+    if (gc_phase != GC_MARKING && nursery_bytes >= gc_nursery_limit)
+	collect_nursery();
+}
+
+
+// color_new_obj
+// Color a newly allocated object. During incremental marking, new objects
+// are allocated black, and survive the collection. While sweeping, objects
+// are only allocated in pages that have already been swept, so they are left
+// white.
+//
+// Pre:
+// - obj's type has been set.
+void color_new_obj(LispObject * obj) {
+    if (gc_phase == GC_MARKING) {
+	set_marked(obj);
+	count_survivor(obj);
+    }
+}
+
+
 // collect_garbage
-// Mark reachable objects and then free unmarked objects.
+// Mark reachable objects, free unmarked objects, and then set the heap limit
+// that triggers the next collection. If an incremental collection is in
+// progress, it is finished first. Unlike collections started by
+// maybe_collect_garbage, this sweeps the whole heap before returning.
 void collect_garbage() {
-    mark();
+    long start = now_ns();
+
+    mark_heap();
+    sweep_slice(0);
+    finish_sweep();
+    log_collection("full", record_pause(start, GC_PAUSE_FULL));
+}
 
-    if (gc_output())
-	printf("\n");
 
-    sweep();
+// collect_nursery
+// Minor collection: mark the young objects reachable from the stack or the
+// remembered set, free the unmarked young objects, and promote the rest. The
+// work done is proportional to the young objects, not the whole heap.
+//
+// A minor collection can run while a full collection is sweeping: the young
+// objects are then in pages that have already been swept, and don't have
+// mark bits set by the full collection.
+void collect_nursery() {
+    // While incremental marking is in progress, the mark bits belong to the
+    // incremental collection, which will promote or free the young objects
+    // once it finishes.
+    if (gc_phase == GC_MARKING)
+	return;
+
+    long start = now_ns();
+    unsigned long young_bytes = nursery_bytes;
+    ++gc_stats.minor_collections;
+    gc_stats.minor_survivors = 0;
+    gc_stats.minor_survivor_bytes = 0;
+    minor_collection = true;
+    TRACE(trace_gc, TRACE_GC_START, NULL, 1);
+    mark_nursery_roots();
+
+    TRACE(trace_gc, TRACE_SWEEP_START, NULL, 0);
+    sweep_nursery();
+    minor_collection = false;
+    TRACE(trace_gc, TRACE_GC_END, NULL, 0);
+
+    remembered_count = 0;
+
+    // Average the cost of this collection into minor_ns_per_kb, for
+    // update_nursery_limit. Tiny nurseries, such as after a collection
+    // called directly, are dominated by fixed costs and are left out.
+    if (young_bytes >= GC_MIN_NURSERY_SIZE) {
+	unsigned long ns_per_kb = (now_ns() - start) * 1024 / young_bytes;
+	if (ns_per_kb == 0)
+	    ns_per_kb = 1;
+	minor_ns_per_kb = (minor_ns_per_kb == 0 ? ns_per_kb
+			   : (3 * minor_ns_per_kb + ns_per_kb) / 4);
+    }
+
+    update_nursery_limit();
+    log_collection("minor", record_pause(start, GC_PAUSE_MINOR));
+}
+
+
+// write_barrier
+// Record that ref has been stored in container. A container of NULL means the
+// global environment. This must be done whenever the global environment or an
+// object that may be black or old is made to point at another object:
+// - During incremental marking, ref is shaded gray if container is black, so
+//   that no black object points at a white one.
+// - If container is old and ref is young, ref is added to the remembered set.
+void write_barrier(LispObject * container, LispObject * ref) {
+    if (gc_phase == GC_MARKING && (container == NULL || is_marked(container))
+	&& !is_fixnum(ref) && !is_marked(ref))
+	push_mark_stack(ref);
+
+    if (is_young(ref) && (container == NULL || !is_young(container)))
+	remember(ref);
+}
 
-    if (gc_output())
-	printf("\n");
+
+// sweep_page
+// Free the unmarked objects in a page that the current full collection has to
+// sweep, adding their slots to the page's free list, and unmark the marked
+// ones, which are old afterwards. Called by sweep_slice, and by heap_alloc
+// before it allocates from the page.
+void sweep_page(struct page * page) {
+    uint64_t dead;
+    LispObject * obj;
+    for (long i = 0; i < HEAP_BITMAP_WORDS; ++i) {
+	// Only write to the page if something in it changes; see heap.h.
+	dead = page->alloc_bits[i] & ~page->marks->mark_bits[i];
+	if (dead != 0)
+	    page->alloc_bits[i] &= ~dead;
+	while (dead != 0) {
+	    obj = slot_obj(page, i * 64 + __builtin_ctzll(dead));
+	    free_obj(obj);
+	    *(LispObject **) obj = page->free_list;
+	    page->free_list = obj;
+	    dead &= dead - 1;
+	}
+	if (page->young_bits[i] != 0)
+	    page->young_bits[i] = 0;
+	page->marks->mark_bits[i] = 0;
+    }
+    page->marks->swept_epoch = heap_sweep_epoch;
 }
 
 
-// b_print_weakrefs
-// Print the weak refs list.
-LispObject * b_print_weakrefs() {
-    LispObject * current = weakrefs_head;
-    while (current != NULL) {
-	print_obj(current);
-	printf(" -> ");
-	current = current->weakref;
+// print_pause_histogram
+// Print the number of pauses of the given kind in each bucket of its pause
+// histogram, skipping empty buckets, and the longest of them.
+void print_pause_histogram(GCPauseKind kind) {
+    for (int i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+	if (gc_pause_histogram[kind][i] == 0)
+	    continue;
+	if (i == 0)
+	    printf("%12s us", "< 1");
+	else if (i == GC_PAUSE_BUCKETS - 1)
+	    printf("%12s us", ">= 2^30");
+	else
+	    printf("%5lu - %5lu us", 1UL << (i - 1), (1UL << i) - 1);
+	printf(": %lu\n", gc_pause_histogram[kind][i]);
     }
-    printf("NULL\n\n");
-    printf("weakrefs count: %lu\n", weakrefs_count);
-    return LISP_EMPTY;
+    printf("max pause: %lu us\n", gc_max_pause_us[kind]);
+}
+
+
+// b_gc_stats
+// Builtin Lisp function gc-stats. Return a list of (name value) lists of
+// collector statistics. live-objects is a list of (type count) lists of the
+// objects that survived the last full collection.
+LispObject * b_gc_stats() {
+    // Building the result allocates objects, so take a snapshot first.
+    struct gc_stats stats = gc_stats;
+    unsigned long allocated_bytes = heap_allocated_bytes;
+    unsigned long allocated_objects = heap_allocated_objects;
+    unsigned long bytes = heap_bytes;
+    unsigned long peak_bytes = heap_peak_bytes;
+
+    // Build the lists back to front on the stack, so they are protected from
+    // collections triggered while building them.
+    LispObject * live_objects_sym = get_sym("live-objects");
+    push(LISP_EMPTY);
+    for (int t = NUM_LISP_TYPES - 1; t >= 0; --t)
+	push_stat(type_name(t), stats.live_objects[t]);
+    LispObject * entry = b_cons(stack[stack_ptr], LISP_EMPTY);
+    entry = b_cons(live_objects_sym, entry);
+    stack[stack_ptr] = b_cons(entry, LISP_EMPTY);
+
+    push_stat("peak-heap-bytes", peak_bytes);
+    push_stat("heap-bytes", bytes);
+    push_stat("allocated-objects", allocated_objects);
+    push_stat("allocated-bytes", allocated_bytes);
+    push_stat("minor-survivor-bytes", stats.minor_survivor_bytes);
+    push_stat("minor-survivors", stats.minor_survivors);
+    push_stat("full-survivor-bytes", stats.full_survivor_bytes);
+    push_stat("full-survivors", stats.full_survivors);
+    push_stat("max-pause-us", stats.max_pause_us);
+    push_stat("total-pause-us", stats.total_pause_us);
+    push_stat("minor-collections", stats.minor_collections);
+    push_stat("full-collections", stats.full_collections);
+
+    LispObject * result = stack[stack_ptr];
+    pop();
+    return result;
 }
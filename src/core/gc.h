@@ -9,22 +9,147 @@
 #include "obj.h"
 
 
+struct page;
+
+
 // ============================================================================
-// Global variables
+// Collection policy
 // ============================================================================
 
-LispObject * weakrefs_head;
+// After each collection, the heap may grow to gc-growth-factor percent of the
+// bytes that survived the collection, but never to less than gc-min-heap
+// bytes, before the next collection is triggered.
+#define GC_DEFAULT_GROWTH_FACTOR 200
+
+#define GC_DEFAULT_MIN_HEAP (1024 * 1024)
+
+// Objects allocated since the last collection are young. A minor collection,
+// which only frees young objects and promotes the surviving ones to the old
+// generation, runs when gc-nursery-size bytes of young objects have been
+// allocated.
+#define GC_DEFAULT_NURSERY_SIZE (256 * 1024)
+
+// If gc-pause-budget is set to a positive int, full collections are
+// incremental: instead of stopping the program until the whole heap has been
+// marked and swept, the collector does a slice of work of at most that many
+// microseconds each time GC_STEP_BYTES more bytes have been allocated.
+#define GC_STEP_BYTES (64 * 1024)
 
-unsigned long weakrefs_count;
+// Full collections sweep lazily: the program resumes once marking is done,
+// the allocator sweeps each page right before it allocates from it, and each
+// time GC_STEP_BYTES more bytes have been allocated, the collector sweeps
+// more pages for at most gc-pause-budget microseconds, or GC_SWEEP_SLICE_US
+// if gc-pause-budget isn't set.
+#define GC_SWEEP_SLICE_US 100
+
+// A minor collection can't be split into slices, so if gc-pause-budget is
+// set, the nursery is made small enough that collecting it takes about half
+// the budget, going by how long recent minor collections took. It is never
+// made smaller than GC_MIN_NURSERY_SIZE bytes, so that a very small budget
+// doesn't make minor collections run after almost every allocation.
+#define GC_MIN_NURSERY_SIZE (16 * 1024)
+
+// maybe_collect_garbage starts a full collection when heap_bytes reaches
+// gc_heap_limit, or runs a minor collection when nursery_bytes reaches
+// gc_nursery_limit.
+unsigned long gc_heap_limit;
+
+unsigned long gc_nursery_limit;
+
+
+// ============================================================================
+// Incremental collection
+// ============================================================================
+
+// During an incremental collection, objects are white (unmarked), gray
+// (waiting on the mark stack to be scanned), or black (marked and scanned).
+// No black object may point at a white object. New objects are allocated
+// black, and write_barrier shades any object stored in a black object or in
+// the global environment.
+typedef enum {
+	      GC_IDLE,
+	      GC_MARKING,
+	      GC_SWEEPING
+} GCPhase;
+
+GCPhase gc_phase;
+
+
+// ============================================================================
+// Pause times
+// ============================================================================
+
+// Pauses are counted separately for each kind: the stop-the-world marking of
+// a full collection, a minor collection, and a slice of incremental marking
+// or of sweeping done by gc_step.
+typedef enum {
+	      GC_PAUSE_FULL,
+	      GC_PAUSE_MINOR,
+	      GC_PAUSE_SLICE,
+	      GC_PAUSE_KINDS
+} GCPauseKind;
+
+// Bucket 0 counts pauses shorter than 1 microsecond, and bucket i > 0 counts
+// pauses of 2^(i - 1) to 2^i - 1 microseconds. The last bucket also counts
+// every longer pause.
+#define GC_PAUSE_BUCKETS 32
+
+unsigned long gc_pause_histogram[GC_PAUSE_KINDS][GC_PAUSE_BUCKETS];
+
+// The longest pause of each kind, in microseconds.
+unsigned long gc_max_pause_us[GC_PAUSE_KINDS];
+
+
+// ============================================================================
+// Statistics
+// ============================================================================
+
+// Counters reported by gc-stats. Pause times include every slice of
+// incremental marking and lazy sweeping. The allocation counters and the
+// peak heap size are kept by the heap allocator; see heap.h.
+//
+// If gc-log is set to a symbol, a line of key=value fields is appended to the
+// file named by the symbol after each collection.
+struct gc_stats {
+    unsigned long full_collections;
+    unsigned long minor_collections;
+    unsigned long total_pause_us;
+    unsigned long max_pause_us;
+
+    // The objects that survived the last full or minor collection.
+    unsigned long full_survivors;
+    unsigned long full_survivor_bytes;
+    unsigned long minor_survivors;
+    unsigned long minor_survivor_bytes;
+
+    // The objects of each type that survived the last full collection.
+    unsigned long live_objects[NUM_LISP_TYPES];
+};
+
+struct gc_stats gc_stats;
 
 
 // ============================================================================
 // Public functions
 // ============================================================================
 
+void init_gc();
+
+void maybe_collect_garbage();
+
+void color_new_obj(LispObject * obj);
+
 void collect_garbage();
 
-LispObject * b_print_weakrefs();
+void collect_nursery();
+
+void write_barrier(LispObject * container, LispObject * ref);
+
+void sweep_page(struct page * page);
+
+void print_pause_histogram(GCPauseKind kind);
+
+LispObject * b_gc_stats();
 
 
 #endif
@@ -5,14 +5,30 @@
 #include "hash.h"
 
 
+// ============================================================================
+// Macros
+// ============================================================================
+
+// The 32-bit FNV-1a hash, which mixes every char into all of the bits, so the
+// low bits alone, which pick a slot in a table whose size is a power of two,
+// are well distributed. Source:
+// http://www.isthe.com/chongo/tech/comp/fnv/
+
+#define FNV_OFFSET_BASIS 2166136261u
+
+#define FNV_PRIME 16777619u
+
+
 // ============================================================================
 // Public functions
 // ============================================================================
 
-unsigned hash_string(char * s) {
-    // Source: K&R C, 2nd ed., p. 144.
-    unsigned hashval = 0;
-    for(long i = 0; s[i] != '\0'; ++i)
-	hashval = s[i] + 31 * hashval;
+// hash_substr
+// Hash the first len chars of s. Symbols cache the hash of their name, which
+// both the intern table and the global environment use.
+unsigned hash_substr(char * s, long len) {
+    unsigned hashval = FNV_OFFSET_BASIS;
+    for(long i = 0; i < len; ++i)
+	hashval = (hashval ^ (unsigned char) s[i]) * FNV_PRIME;
     return hashval;
 }
@@ -10,7 +10,7 @@
 // Public functions
 // ============================================================================
 
-unsigned hash_string(char * s);
+unsigned hash_substr(char * s, long len);
 
 
 #endif
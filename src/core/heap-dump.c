@@ -0,0 +1,141 @@
+// heap-dump.c
+// Source for heap snapshots.
+
+
+#include <stdio.h>
+
+#include "env.h"
+#include "error.h"
+#include "gc.h"
+#include "heap.h"
+#include "heap-dump.h"
+#include "intern.h"
+#include "obj.h"
+#include "stack.h"
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+void dump_obj(FILE * file, LispObject * obj);
+
+void dump_ref(FILE * file, LispObject * obj);
+
+void dump_root(FILE * file, char * kind, char * label, LispObject * obj);
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// heap_dump
+// Collect garbage, so that only live objects are left, and write a heap dump
+// to the file named file_name. Return whether the file could be written.
+bool heap_dump(char * file_name) {
+    FILE * file = fopen(file_name, "w");
+    if (file == NULL) {
+	printf("Could not open heap dump file %s\n", file_name);
+	return false;
+    }
+
+    collect_garbage();
+
+    fprintf(file, "lisp-heap-dump 2\n");
+
+    struct page * page;
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c)
+	for (page = size_classes[c].pages; page != NULL; page = page->next)
+	    for (unsigned slot = 0; slot < page->nslots; ++slot)
+		if ((page->alloc_bits[slot / 64] >> (slot % 64)) & 1)
+		    dump_obj(file, slot_obj(page, slot));
+
+    dump_root(file, "initial", "()", LISP_EMPTY);
+
+    LispObject * sym;
+    for (unsigned long i = 0; i < intern_size; ++i)
+	for (sym = intern_table[i]; sym != NULL; sym = sym->intern_next)
+	    dump_root(file, "symbol", sym->print_name, sym);
+
+    struct binding * b;
+    for (unsigned long i = 0; i < env_capacity; ++i) {
+	b = global_env[i].binding;
+	if (b != NULL)
+	    dump_root(file, "global", b->name->print_name, b->def);
+    }
+
+    char label[32];
+    for (long i = 1; i <= stack_ptr; ++i) {
+	sprintf(label, "%ld", i);
+	dump_root(file, "stack", label, stack[i]);
+    }
+
+    bool success = (ferror(file) == 0);
+    if (fclose(file) != 0)
+	success = false;
+    if (!success)
+	printf("Could not write heap dump file %s\n", file_name);
+    return success;
+}
+
+
+// b_heap_dump
+// Builtin Lisp function heap-dump. Write a heap dump to the file named by a
+// symbol, and return the symbol.
+LispObject * b_heap_dump(LispObject * name) {
+    if (!typecheck(name, get_sym("symbol?")))
+	return NULL;
+
+    // Symbols are never freed, so name doesn't have to be protected from the
+    // collection that heap_dump does.
+    return (heap_dump(name->print_name) ? name : NULL);
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// dump_obj
+// Write the line for an object.
+void dump_obj(FILE * file, LispObject * obj) {
+    fprintf(file, "o %p %s %u", (void *) obj, type_name(obj->type),
+	    obj_page(obj)->slot_size);
+
+    if (obj->type == TYPE_PAIR) {
+	dump_ref(file, obj->car);
+	dump_ref(file, obj->cdr);
+    }
+    else if (obj->type == TYPE_LAMBDA) {
+	dump_ref(file, obj->args);
+	dump_ref(file, obj->body);
+	dump_ref(file, obj->env);
+    }
+    else if (obj->type == TYPE_FRAME) {
+	dump_ref(file, obj->parent);
+	dump_ref(file, obj->names);
+	for (long i = 0; i < obj->slot_count; ++i)
+	    dump_ref(file, frame_slots(obj)[i]);
+    }
+    else if (is_builtin(obj))
+	dump_ref(file, obj->builtin_name);
+    fprintf(file, "\n");
+}
+
+
+// dump_ref
+// Write a reference to an object, or 0 for a tagged int.
+void dump_ref(FILE * file, LispObject * obj) {
+    if (is_fixnum(obj))
+	fprintf(file, " 0");
+    else
+	fprintf(file, " %p", (void *) obj);
+}
+
+
+// dump_root
+// Write the line for a root.
+void dump_root(FILE * file, char * kind, char * label, LispObject * obj) {
+    if (!is_fixnum(obj))
+	fprintf(file, "r %s %s %p\n", kind, label, (void *) obj);
+}
@@ -0,0 +1,40 @@
+// heap-dump.h
+// Header for heap snapshots.
+//
+// A heap dump is a text file describing every object in the heap and every
+// root, for working out offline what is keeping memory alive; see
+// tools/heap-summary.c. The first line is "lisp-heap-dump 2", and each line
+// after it is one of:
+//
+//   o ADDR TYPE SIZE REF...   an object, its size in bytes, and the addresses
+//                             of the objects it refers to
+//   r KIND LABEL ADDR         a root that refers to the object at ADDR
+//
+// where KIND is "global" (LABEL is the name of the global binding), "stack"
+// (LABEL is the stack slot), "symbol" (LABEL is the symbol's name; interned
+// symbols are never freed), or "initial" (an object in the initial set of
+// objects). Addresses are in hex. A reference to a tagged int, which isn't a
+// heap object, is written as 0, so that an object always has the same number
+// of references for its type; a pair's are its car and then its cdr. Roots
+// that are tagged ints are left out.
+
+
+#ifndef HEAP_DUMP_H
+#define HEAP_DUMP_H
+
+
+#include <stdbool.h>
+
+#include "obj.h"
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+bool heap_dump(char * file_name);
+
+LispObject * b_heap_dump(LispObject * name);
+
+
+#endif
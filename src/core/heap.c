@@ -0,0 +1,330 @@
+// heap.c
+// Source for the heap allocator.
+
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "heap.h"
+#include "error.h"
+#include "gc.h"
+#include "print.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// The size of an object whose last data member is MEMBER, rounded up to a
+// multiple of 8 bytes.
+#define OBJ_SIZE(MEMBER) \
+    ((offsetof(LispObject, MEMBER) + sizeof(((LispObject *) 0)->MEMBER) + 7) \
+     & ~(size_t) 7)
+
+// Slots start at the first 16-byte boundary after the page header.
+#define SLOTS_OFFSET ((sizeof(struct page) + 15) & ~(size_t) 15)
+
+
+// ============================================================================
+// Private variables
+// ============================================================================
+
+// Empty pages kept for new_page to reuse, linked through their next members.
+// Pages are too big for malloc to carve out of its heap, so each one is
+// mapped and unmapped by the system separately, which is slow enough to
+// matter to collection pauses.
+struct page * free_pages;
+
+unsigned long free_page_count;
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+LispObject * alloc_slot(SizeClass size_class, LispType type);
+
+SizeClass get_size_class(LispType type);
+
+void init_size_class(SizeClass size_class, unsigned slot_size);
+
+struct page * new_page(SizeClass size_class);
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// init_heap
+// This function must be called before any object is constructed.
+void init_heap() {
+    heap_object_count = 0;
+    heap_bytes = 0;
+    heap_allocated_bytes = 0;
+    heap_allocated_objects = 0;
+    heap_peak_bytes = 0;
+    heap_page_count = 0;
+    heap_sweep_epoch = 0;
+    free_pages = NULL;
+    free_page_count = 0;
+    nursery_pages = NULL;
+    nursery_bytes = 0;
+
+    init_size_class(SIZE_CLASS_PAIR, OBJ_SIZE(cdr));
+    init_size_class(SIZE_CLASS_SYM, OBJ_SIZE(binding));
+    init_size_class(SIZE_CLASS_LAMBDA, OBJ_SIZE(code));
+    init_size_class(SIZE_CLASS_BUILTIN, OBJ_SIZE(max_args));
+    init_size_class(SIZE_CLASS_SMALL, OBJ_SIZE(value));
+    for (int i = 0; i < FRAME_SIZE_CLASSES; ++i)
+	init_size_class(SIZE_CLASS_FRAME + i, (OBJ_SIZE(slot_count)
+					       + (sizeof(LispObject *) << i)));
+}
+
+
+// heap_alloc
+// Allocate an uninitialized slot for an object of the given type.
+LispObject * heap_alloc(LispType type) {
+    return alloc_slot(get_size_class(type), type);
+}
+
+
+// heap_alloc_frame
+// Allocate an uninitialized slot for a frame with room for slot_count
+// variables.
+LispObject * heap_alloc_frame(long slot_count) {
+    ASSERT(slot_count >= 0 && slot_count <= FRAME_MAX_SLOTS);
+
+    int i = 0;
+    while ((1L << i) < slot_count)
+	++i;
+    return alloc_slot(SIZE_CLASS_FRAME + i, TYPE_FRAME);
+}
+
+
+// release_page
+// Unlink an empty page from its size class, and keep it for reuse or return
+// it to the system.
+void release_page(struct page * page) {
+    ASSERT(page->live == 0);
+
+    struct size_class * sc = &size_classes[page->size_class];
+    if (page->prev != NULL)
+	page->prev->next = page->next;
+    else
+	sc->pages = page->next;
+    if (page->next != NULL)
+	page->next->prev = page->prev;
+
+    if (sc->alloc_page == page)
+	sc->alloc_page = sc->pages;
+
+    // The nursery list only holds pages allocated from since the last
+    // collection, so it's short enough to search.
+    if (page->in_nursery) {
+	struct page ** link = &nursery_pages;
+	while (*link != page)
+	    link = &(*link)->nursery_next;
+	*link = page->nursery_next;
+    }
+
+    --heap_page_count;
+
+    // The heap grows back to gc_heap_limit before the next full collection,
+    // so keep as many pages as that will need.
+    if ((heap_page_count + free_page_count) * HEAP_PAGE_SIZE < gc_heap_limit) {
+	page->next = free_pages;
+	free_pages = page;
+	++free_page_count;
+    }
+    else {
+	free(page->marks);
+	free(page);
+    }
+}
+
+
+// reset_nursery
+// Empty the nursery list. Called by the garbage collector after it has
+// promoted or freed every young object.
+void reset_nursery() {
+    struct page * page = nursery_pages;
+    while (page != NULL) {
+	page->in_nursery = false;
+	page = page->nursery_next;
+    }
+    nursery_pages = NULL;
+    nursery_bytes = 0;
+}
+
+
+// b_print_heap
+// Print every allocated object, page by page.
+LispObject * b_print_heap() {
+    struct page * page;
+    for (int c = 0; c < NUM_SIZE_CLASSES; ++c) {
+	for (page = size_classes[c].pages; page != NULL; page = page->next) {
+	    printf("page %p (size class %d, %u/%u slots live):\n",
+		   (void *) page, c, page->live, page->nslots);
+	    for (unsigned slot = 0; slot < page->nslots; ++slot) {
+		if ((page->alloc_bits[slot / 64] >> (slot % 64)) & 1) {
+		    printf("  ");
+		    print_obj(slot_obj(page, slot));
+		    printf("\n");
+		}
+	    }
+	}
+    }
+    printf("\nobject count: %lu\n", heap_object_count);
+    printf("page count: %lu\n", heap_page_count);
+    return LISP_EMPTY;
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// alloc_slot
+// Allocate an uninitialized slot in the given size class for an object of the
+// given type.
+LispObject * alloc_slot(SizeClass size_class, LispType type) {
+    struct size_class * sc = &size_classes[size_class];
+    struct page * page = sc->alloc_page;
+    while (page != NULL) {
+	if (page_needs_sweep(page))
+	    sweep_page(page);
+	if (page->free_list != NULL || page->bump != page->end)
+	    break;
+	page = page->next;
+    }
+    if (page == NULL)
+	page = new_page(size_class);
+    sc->alloc_page = page;
+
+    LispObject * obj;
+    if (page->free_list != NULL) {
+	obj = page->free_list;
+	page->free_list = *(LispObject **) obj;
+    }
+    else {
+	obj = (LispObject *) page->bump;
+	page->bump += page->slot_size;
+    }
+
+    unsigned slot = obj_slot(page, obj);
+    ASSERT(!((page->alloc_bits[slot / 64] >> (slot % 64)) & 1));
+    page->alloc_bits[slot / 64] |= (uint64_t) 1 << (slot % 64);
+    ++page->live;
+    ++heap_object_count;
+    heap_bytes += page->slot_size;
+    heap_allocated_bytes += page->slot_size;
+    ++heap_allocated_objects;
+    if (heap_bytes > heap_peak_bytes)
+	heap_peak_bytes = heap_bytes;
+
+    // Symbols are never freed, so they are allocated directly in the old
+    // generation. This also means minor collections don't need to mark the
+    // intern table.
+    if (type != TYPE_SYM) {
+	page->young_bits[slot / 64] |= (uint64_t) 1 << (slot % 64);
+	nursery_bytes += page->slot_size;
+	if (!page->in_nursery) {
+	    page->in_nursery = true;
+	    page->nursery_next = nursery_pages;
+	    nursery_pages = page;
+	}
+    }
+
+    return obj;
+}
+
+
+SizeClass get_size_class(LispType type) {
+    switch (type) {
+    case TYPE_PAIR:
+	return SIZE_CLASS_PAIR;
+    case TYPE_SYM:
+	return SIZE_CLASS_SYM;
+    case TYPE_LAMBDA:
+	return SIZE_CLASS_LAMBDA;
+    case TYPE_BUILTIN_0:
+    case TYPE_BUILTIN_1:
+    case TYPE_BUILTIN_2:
+    case TYPE_BOOL_BUILTIN_1:
+    case TYPE_BOOL_BUILTIN_2:
+    case TYPE_BUILTIN_N:
+	return SIZE_CLASS_BUILTIN;
+    case TYPE_INT:
+    case TYPE_UNIQUE:
+	return SIZE_CLASS_SMALL;
+    case TYPE_FRAME:
+	// Frames vary in size; see heap_alloc_frame.
+	break;
+    }
+    FOUND_BUG;
+}
+
+
+void init_size_class(SizeClass size_class, unsigned slot_size) {
+    ASSERT(slot_size >= 16 && slot_size % 8 == 0);
+
+    struct size_class * sc = &size_classes[size_class];
+    sc->slot_size = slot_size;
+    sc->slots_per_page = (HEAP_PAGE_SIZE - SLOTS_OFFSET) / slot_size;
+    sc->pages = NULL;
+    sc->alloc_page = NULL;
+}
+
+
+// new_page
+// Allocate an empty page, or reuse one that was released, and add it to the
+// given size class.
+struct page * new_page(SizeClass size_class) {
+    struct page * page;
+    struct page_marks * marks;
+    if (free_pages != NULL) {
+	page = free_pages;
+	free_pages = page->next;
+	--free_page_count;
+	marks = page->marks;
+	*marks = (struct page_marks) {0};
+    }
+    else {
+	page = aligned_alloc(HEAP_PAGE_SIZE, HEAP_PAGE_SIZE);
+	marks = calloc(1, sizeof(struct page_marks));
+	if (page == NULL || marks == NULL) {
+	    printf("\nOut of memory.\n");
+	    exit(1);
+	}
+    }
+
+    struct size_class * sc = &size_classes[size_class];
+    page->size_class = size_class;
+    page->slot_size = sc->slot_size;
+    page->nslots = sc->slots_per_page;
+    page->live = 0;
+    page->slots = (char *) page + SLOTS_OFFSET;
+    page->free_list = NULL;
+    page->bump = page->slots;
+    page->end = page->slots + (size_t) page->nslots * page->slot_size;
+
+    for (long i = 0; i < HEAP_BITMAP_WORDS; ++i) {
+	page->alloc_bits[i] = 0;
+	page->young_bits[i] = 0;
+    }
+    page->in_nursery = false;
+    page->marks = marks;
+
+    // Objects allocated now don't have to be swept by a collection that is
+    // already sweeping.
+    marks->swept_epoch = heap_sweep_epoch;
+
+    page->prev = NULL;
+    page->next = sc->pages;
+    if (sc->pages != NULL)
+	sc->pages->prev = page;
+    sc->pages = page;
+    ++heap_page_count;
+
+    return page;
+}
@@ -0,0 +1,233 @@
+// heap.h
+// Header for the heap allocator.
+//
+// Objects are allocated out of fixed-size pages. Each page holds objects of a
+// single size class, and each object kind (pairs, symbols, lambdas, ...) has
+// its own size class, so a page is an array of equally sized slots. Frames
+// vary in size, so they have several size classes, for frames of up to 1, 2,
+// 4, ..., FRAME_MAX_SLOTS variables. A page
+// keeps one bit per slot recording whether the slot is allocated and one bit
+// per slot recording whether the object in it has been marked by the garbage
+// collector, so the sweep phase can walk each page linearly.
+//
+// Mark bits are not kept in the page itself but in a side table that the page
+// points to, and sweeping only writes to a page's bitmaps when something in the
+// page has changed. So a full collection doesn't write to pages that hold
+// nothing but old, live objects, and after fork such pages stay shared
+// copy-on-write between the parent and child processes however many times
+// either one collects.
+//
+// The heap has two generations. Objects start out young and are promoted to
+// the old generation when they survive a collection. Each page keeps a third
+// bitmap recording which of its objects are young, and pages that contain
+// young objects are linked into the nursery list so that a minor collection
+// only has to sweep those pages.
+
+
+#ifndef HEAP_H
+#define HEAP_H
+
+
+#include <stdint.h>
+
+#include "obj.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// Pages are aligned to their size, so the page that contains an object can
+// be found by masking the object's address.
+#define HEAP_PAGE_SIZE (64 * 1024)
+
+// The smallest slot size is 16 bytes, so no page has more slots than this.
+#define HEAP_MAX_SLOTS (HEAP_PAGE_SIZE / 16)
+
+#define HEAP_BITMAP_WORDS (HEAP_MAX_SLOTS / 64)
+
+// The number of frame size classes. The largest holds frames of
+// FRAME_MAX_SLOTS variables.
+#define FRAME_SIZE_CLASSES 10
+
+
+// ============================================================================
+// Size classes
+// ============================================================================
+
+typedef enum {
+	      SIZE_CLASS_PAIR,
+	      SIZE_CLASS_SYM,
+	      SIZE_CLASS_LAMBDA,
+	      SIZE_CLASS_BUILTIN,
+	      SIZE_CLASS_SMALL,  // boxed ints and the empty list
+	      SIZE_CLASS_FRAME,  // the first of FRAME_SIZE_CLASSES
+	      NUM_SIZE_CLASSES = SIZE_CLASS_FRAME + FRAME_SIZE_CLASSES
+} SizeClass;
+
+struct size_class {
+    unsigned slot_size;
+    unsigned slots_per_page;
+
+    // All pages of this size class.
+    struct page * pages;
+
+    // The page that objects are currently allocated from. Allocation moves
+    // through the pages list from here until it finds a page with a free
+    // slot, sweeping pages that still have to be swept on the way, and the
+    // collector resets it to the start of the list.
+    struct page * alloc_page;
+};
+
+struct size_class size_classes[NUM_SIZE_CLASSES];
+
+
+// ============================================================================
+// Pages
+// ============================================================================
+
+// A page's side table: the state that a full collection writes for every
+// page, kept out of the page.
+struct page_marks {
+    uint64_t mark_bits[HEAP_BITMAP_WORDS];
+
+    // The value of heap_sweep_epoch when the page was last swept, or when
+    // it was created; see page_needs_sweep.
+    unsigned long swept_epoch;
+};
+
+struct page {
+    // The pages before and after this one in its size class's pages list.
+    // The list is doubly linked so that releasing a page doesn't have to
+    // search for it.
+    struct page * prev;
+    struct page * next;
+    SizeClass size_class;
+    unsigned slot_size;
+    unsigned nslots;
+    unsigned live;  // number of allocated slots
+    char * slots;
+
+    // Freed slots, linked through the first word of each free slot.
+    LispObject * free_list;
+
+    // Slots from bump to the end of the page have never been allocated.
+    char * bump;
+    char * end;
+
+    uint64_t alloc_bits[HEAP_BITMAP_WORDS];
+    uint64_t young_bits[HEAP_BITMAP_WORDS];
+
+    // Whether the page is in the nursery list, and the next page in it.
+    bool in_nursery;
+    struct page * nursery_next;
+
+    struct page_marks * marks;
+};
+
+// Total number of allocated objects, bytes in allocated slots, and pages
+// across all size classes.
+unsigned long heap_object_count;
+
+unsigned long heap_bytes;
+
+// Total number of bytes and objects ever allocated. Unlike heap_bytes, these
+// never decrease.
+unsigned long heap_allocated_bytes;
+
+unsigned long heap_allocated_objects;
+
+// The largest value heap_bytes has had.
+unsigned long heap_peak_bytes;
+
+unsigned long heap_page_count;
+
+// Incremented by each full collection when it starts sweeping, so that every
+// page that exists then has to be swept, without having to visit each page
+// to say so.
+unsigned long heap_sweep_epoch;
+
+// Pages that have had young objects allocated in them since the last
+// collection, and the number of bytes allocated in young objects since then.
+struct page * nursery_pages;
+
+unsigned long nursery_bytes;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+void init_heap();
+
+LispObject * heap_alloc(LispType type);
+
+LispObject * heap_alloc_frame(long slot_count);
+
+void release_page(struct page * page);
+
+void reset_nursery();
+
+LispObject * b_print_heap();
+
+
+// ----------------------------------------------------------------------------
+// Slot bitmaps
+// ----------------------------------------------------------------------------
+
+static inline struct page * obj_page(LispObject * obj) {
+    return (struct page *) ((uintptr_t) obj & ~((uintptr_t) HEAP_PAGE_SIZE - 1));
+}
+
+static inline unsigned obj_slot(struct page * page, LispObject * obj) {
+    return ((char *) obj - page->slots) / page->slot_size;
+}
+
+static inline LispObject * slot_obj(struct page * page, unsigned slot) {
+    return (LispObject *) (page->slots + (uintptr_t) slot * page->slot_size);
+}
+
+static inline bool is_marked(LispObject * obj) {
+    struct page * page = obj_page(obj);
+    unsigned slot = obj_slot(page, obj);
+    return (page->marks->mark_bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+static inline void set_marked(LispObject * obj) {
+    struct page * page = obj_page(obj);
+    unsigned slot = obj_slot(page, obj);
+    page->marks->mark_bits[slot / 64] |= (uint64_t) 1 << (slot % 64);
+}
+
+// try_mark
+// Set an object's mark bit and return whether it wasn't set before. Unlike
+// set_marked, this is safe to call from several marking threads at once.
+static inline bool try_mark(LispObject * obj) {
+    struct page * page = obj_page(obj);
+    unsigned slot = obj_slot(page, obj);
+    uint64_t bit = (uint64_t) 1 << (slot % 64);
+    uint64_t * word = &page->marks->mark_bits[slot / 64];
+
+    // Checking first avoids a slow atomic operation for marked objects.
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit)
+	return false;
+    return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+}
+
+// page_needs_sweep
+// Return whether a page still has to be swept by the current full
+// collection.
+static inline bool page_needs_sweep(struct page * page) {
+    return page->marks->swept_epoch != heap_sweep_epoch;
+}
+
+static inline bool is_young(LispObject * obj) {
+    if (is_fixnum(obj))
+	return false;
+    struct page * page = obj_page(obj);
+    unsigned slot = obj_slot(page, obj);
+    return (page->young_bits[slot / 64] >> (slot % 64)) & 1;
+}
+
+
+#endif
@@ -0,0 +1,149 @@
+// intern.c
+// Source for the symbol intern table.
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+#include "error.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// Symbol names are copied into arena chunks of this many bytes. A name that
+// doesn't fit in a chunk gets a chunk of its own.
+#define NAME_CHUNK_SIZE 4096
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+void grow_intern_table();
+
+
+// ============================================================================
+// Private variables
+// ============================================================================
+
+// The current arena chunk and the number of bytes still free at its end.
+// Chunks are never freed, because interned symbols are never freed.
+char * name_chunk;
+
+long name_chunk_free;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// init_intern_table
+// This function must be called before any symbol is constructed.
+void init_intern_table() {
+    intern_size = INTERN_INITIAL_SIZE;
+    intern_count = 0;
+    intern_table = calloc(intern_size, sizeof(LispObject *));
+    if (intern_table == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+
+    name_chunk = NULL;
+    name_chunk_free = 0;
+}
+
+
+// find_interned
+// Return the symbol whose name is the first len chars of str, or NULL if no
+// such symbol has been interned.
+//
+// Pre:
+// - hash == hash_substr(str, len)
+LispObject * find_interned(char * str, long len, unsigned hash) {
+    LispObject * sym = intern_table[hash % intern_size];
+    for (; sym != NULL; sym = sym->intern_next) {
+	if (sym->hash == hash
+	    && strncmp(sym->print_name, str, len) == 0
+	    && sym->print_name[len] == '\0')
+	    return sym;
+    }
+    return NULL;
+}
+
+
+// add_interned
+// Add a newly constructed symbol to the intern table.
+//
+// Pre:
+// - sym's print_name and hash are set.
+// - No symbol with the same name has been interned.
+void add_interned(LispObject * sym) {
+    ASSERT(b_symbol_pred(sym));
+
+    unsigned long index = sym->hash % intern_size;
+    sym->intern_next = intern_table[index];
+    intern_table[index] = sym;
+    ++intern_count;
+
+    if (intern_count > intern_size)
+	grow_intern_table();
+}
+
+
+// copy_name
+// Copy the first len chars of str into the name arena and return the
+// null-terminated copy.
+char * copy_name(char * str, long len) {
+    if (len + 1 > name_chunk_free) {
+	long size = (len + 1 > NAME_CHUNK_SIZE ? len + 1 : NAME_CHUNK_SIZE);
+	name_chunk = malloc(size);
+	if (name_chunk == NULL) {
+	    printf("\nOut of memory.\n");
+	    exit(1);
+	}
+	name_chunk_free = size;
+    }
+
+    char * name = name_chunk;
+    memcpy(name, str, len);
+    name[len] = '\0';
+
+    name_chunk += len + 1;
+    name_chunk_free -= len + 1;
+    return name;
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// grow_intern_table
+// Double the number of buckets and rehash every symbol using its cached hash.
+void grow_intern_table() {
+    unsigned long new_size = intern_size * 2;
+    LispObject ** new_table = calloc(new_size, sizeof(LispObject *));
+    if (new_table == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+
+    LispObject * sym;
+    LispObject * next;
+    for (unsigned long i = 0; i < intern_size; ++i) {
+	for (sym = intern_table[i]; sym != NULL; sym = next) {
+	    next = sym->intern_next;
+	    unsigned long index = sym->hash % new_size;
+	    sym->intern_next = new_table[index];
+	    new_table[index] = sym;
+	}
+    }
+
+    free(intern_table);
+    intern_table = new_table;
+    intern_size = new_size;
+}
@@ -0,0 +1,44 @@
+// intern.h
+// Header for the symbol intern table.
+//
+// Every symbol name maps to exactly one symbol object, so symbols can be
+// compared with ==. Interned symbols are never freed: the intern table is part
+// of the set of objects marked by the garbage collector.
+
+
+#ifndef INTERN_H
+#define INTERN_H
+
+
+#include "obj.h"
+
+
+// ============================================================================
+// Intern table
+// ============================================================================
+
+#define INTERN_INITIAL_SIZE 256
+
+// Chaining hash table of symbols. Each bucket is a chain of symbol objects
+// linked through their intern_next members.
+LispObject ** intern_table;
+
+unsigned long intern_size;
+
+unsigned long intern_count;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+void init_intern_table();
+
+LispObject * find_interned(char * str, long len, unsigned hash);
+
+void add_interned(LispObject * sym);
+
+char * copy_name(char * str, long len);
+
+
+#endif
@@ -5,13 +5,20 @@
 #include <stdio.h>
 
 #include "obj.h"
+#include "ast.h"
 #include "builtins.h"
 #include "env.h"
 #include "eval.h"
 #include "gc.h"
 #include "error.h"
+#include "hash.h"
+#include "heap.h"
+#include "heap-dump.h"
+#include "intern.h"
+#include "parallel-mark.h"
 #include "print.h"
 #include "stack.h"
+#include "trace.h"
 
 
 // ============================================================================
@@ -20,9 +27,9 @@
 
 LispObject * get_obj(LispType type);
 
-LispObject * get_empty_list();
+LispObject * init_obj(LispObject * obj, LispType type);
 
-LispObject * get_sym(char * str);
+LispObject * get_empty_list();
 
 LispObject * get_builtin(char * name_str, LispType type);
 
@@ -40,6 +47,10 @@ void make_bool_builtin_1(char * name_str,
 void make_bool_builtin_2(char * name_str,
 				bool (* b_bool_func_2)(LispObject *, LispObject *));
 
+void make_builtin_n(char * name_str,
+		    LispObject * (* b_func_n)(long args, long arg_count),
+		    long min_args, long max_args);
+
 
 // ============================================================================
 // LispObject
@@ -58,6 +69,9 @@ void make_initial_objs() {
     LISP_COND = get_sym("cond");
     LISP_DEFINE = get_sym("define");
     LISP_LAMBDA = get_sym("lambda");
+    LISP_AND = get_sym("and");
+    LISP_OR = get_sym("or");
+    LISP_NOT = get_sym("not");
 
     make_builtin_1("eval", &b_eval);
     make_builtin_2("cons", &b_cons);
@@ -65,14 +79,19 @@ void make_initial_objs() {
     make_builtin_1("cdr", &b_cdr);
     make_builtin_1("length", &b_length);
 
-    make_builtin_2("+", &b_add);
-    make_builtin_2("-", &b_sub);
-    make_builtin_2("*", &b_mul);
-    make_builtin_2("/", &b_div);
+    make_builtin_n("+", &b_add, 0, -1);
+    make_builtin_n("-", &b_sub, 1, -1);
+    make_builtin_n("*", &b_mul, 0, -1);
+    make_builtin_n("/", &b_div, 1, -1);
 
     make_bool_builtin_2("equal?", &b_equal_pred);
-    make_builtin_2("<", &b_lt);
+    make_builtin_n("=", &b_num_eq, 1, -1);
+    make_builtin_n("<", &b_lt, 1, -1);
+    make_builtin_n(">", &b_gt, 1, -1);
+    make_builtin_n("<=", &b_le, 1, -1);
+    make_builtin_n(">=", &b_ge, 1, -1);
 
+    make_bool_builtin_1("not", &b_not);
     make_bool_builtin_1("null?", &b_null_pred);
     make_bool_builtin_1("symbol?", &b_symbol_pred);
     make_bool_builtin_1("function?", &b_function_pred);
@@ -89,7 +108,10 @@ void make_initial_objs() {
     make_bool_builtin_1(list_pred_str, &b_list_pred);
     LISP_LIST_PRED_SYM = get_sym(list_pred_str);
 
-    make_builtin_0("print-weakrefs", &b_print_weakrefs);
+    make_builtin_0("print-heap", &b_print_heap);
+    make_builtin_0("gc-stats", &b_gc_stats);
+    make_builtin_0("print-trace", &b_print_trace);
+    make_builtin_1("heap-dump", &b_heap_dump);
     make_builtin_1("print-env", &b_print_env);
 
     LISP_GC_OUTPUT = get_sym("gc-output");
@@ -97,6 +119,30 @@ void make_initial_objs() {
 
     LISP_STACK_OUTPUT = get_sym("stack-output");
     bind(LISP_STACK_OUTPUT, LISP_F, false);
+
+    LISP_GC_GROWTH_FACTOR = get_sym("gc-growth-factor");
+    bind(LISP_GC_GROWTH_FACTOR, get_int(GC_DEFAULT_GROWTH_FACTOR), false);
+
+    LISP_GC_MIN_HEAP = get_sym("gc-min-heap");
+    bind(LISP_GC_MIN_HEAP, get_int(GC_DEFAULT_MIN_HEAP), false);
+
+    LISP_GC_NURSERY_SIZE = get_sym("gc-nursery-size");
+    bind(LISP_GC_NURSERY_SIZE, get_int(GC_DEFAULT_NURSERY_SIZE), false);
+
+    LISP_GC_PAUSE_BUDGET = get_sym("gc-pause-budget");
+    bind(LISP_GC_PAUSE_BUDGET, LISP_F, false);
+
+    LISP_GC_THREADS = get_sym("gc-threads");
+    bind(LISP_GC_THREADS, get_int(cpu_count()), false);
+
+    LISP_GC_LOG = get_sym("gc-log");
+    bind(LISP_GC_LOG, LISP_F, false);
+
+    LISP_MAX_DEPTH = get_sym("max-depth");
+    bind(LISP_MAX_DEPTH, get_int(STACK_DEFAULT_MAX_DEPTH), false);
+
+    LISP_USE_BYTECODE = get_sym("use-bytecode");
+    bind(LISP_USE_BYTECODE, LISP_T, false);
 }
 
 
@@ -105,8 +151,12 @@ void make_initial_objs() {
 // ----------------------------------------------------------------------------
 
 // get_int
-// Construct a Lisp int.
+// Construct a Lisp int. Only ints outside of the tagged int range are
+// allocated on the heap.
 LispObject * get_int(long value) {
+    if (value >= FIXNUM_MIN && value <= FIXNUM_MAX)
+	return make_fixnum(value);
+
     LispObject * obj = get_obj(TYPE_INT);
     obj->value = value;
     return obj;
@@ -114,52 +164,92 @@ LispObject * get_int(long value) {
 
 
 // get_sym
-// Construct a Lisp symbol from str.
+// Return the symbol named str.
 LispObject * get_sym(char * str) {
     long len = 0;
     while (str[len] != '\0')
 	++len;
-
-    LispObject * obj = get_obj(TYPE_SYM);
-    obj->print_name = malloc((len + 1) * sizeof(char));
-
-    for (long i = 0; i < len; ++i)
-	obj->print_name[i] = str[i];
-    obj->print_name[len] = '\0';
-    
-    return obj;
+    return get_sym_by_substr(str, 0, len);
 }
 
 
 // get_sym_by_substr
-// Construct a Lisp symbol from a substr of str.
+// Return the symbol named by a substr of str, constructing and interning it
+// if it doesn't exist yet.
 LispObject * get_sym_by_substr(char * str, long begin, long end) {
     long len = end - begin;
+    unsigned hash = hash_substr(str + begin, len);
 
-    LispObject * obj = get_obj(TYPE_SYM);
-    obj->print_name = malloc((len + 1) * sizeof(char));
+    LispObject * obj = find_interned(str + begin, len, hash);
+    if (obj != NULL)
+	return obj;
 
-    for (long i = 0; i < len; ++i)
-	obj->print_name[i] = str[begin + i];
-    obj->print_name[len] = '\0';
+    obj = get_obj(TYPE_SYM);
+    obj->print_name = copy_name(str + begin, len);
+    obj->hash = hash;
+    obj->binding = NULL;
+    add_interned(obj);
 
     return obj;
 }
 
 
 // get_lambda
-// Construct a Lisp lambda function.
+// Construct a Lisp lambda function from an analyzed lambda expression.
 //
 // Pre:
-// - args, body, and env_list are protected from garbage collection.
-// - args is the empty list or a list of symbols.
-// - env_list is the current list of local environments, of the same form as
-//   described by eval's pre.
-LispObject * get_lambda(LispObject * args, LispObject * body, LispObject * env_list) {
+// - code's parameter list and body, and env, are protected from garbage
+//   collection.
+// - env is the current frame, as described by eval_node's pre.
+LispObject * get_lambda(struct code * code, LispObject * env) {
+    LispObject * args = code->params;
+    LispObject * body = code->body;
+
     LispObject * obj = get_obj(TYPE_LAMBDA);
     obj->args = args;
     obj->body = body;
-    obj->env_list = env_list;
+    obj->env = env;
+    obj->code = code;
+    retain_code(code);
+
+    // obj may have been allocated black during an incremental collection.
+    // It is young, so these don't add to the remembered set.
+    write_barrier(obj, args);
+    write_barrier(obj, body);
+    write_barrier(obj, env);
+
+    return obj;
+}
+
+
+// get_frame
+// Construct a frame whose variables, named by names, are bound to the top
+// slot_count objects on the stack, in the order they were pushed. The objects
+// are left on the stack.
+//
+// Pre:
+// - parent and names are protected from garbage collection.
+// - names is a list of slot_count symbols.
+LispObject * get_frame(LispObject * parent, LispObject * names,
+		       long slot_count) {
+    maybe_collect_garbage();
+
+    LispObject * obj = init_obj(heap_alloc_frame(slot_count), TYPE_FRAME);
+    obj->parent = parent;
+    obj->names = names;
+    obj->slot_count = slot_count;
+
+    // obj may have been allocated black during an incremental collection.
+    // It is young, so these don't add to the remembered set.
+    write_barrier(obj, parent);
+    write_barrier(obj, names);
+
+    LispObject ** slots = frame_slots(obj);
+    LispObject ** values = &stack[stack_ptr - slot_count + 1];
+    for (long i = 0; i < slot_count; ++i) {
+	slots[i] = values[i];
+	write_barrier(obj, values[i]);
+    }
 
     return obj;
 }
@@ -177,10 +267,14 @@ LispObject * b_cons(LispObject * car, LispObject * cdr) {
     pop();
     pop();
 
-    obj->is_list = cdr->is_list;
+    obj->is_list = b_list_pred(cdr);
     obj->car = car;
     obj->cdr = cdr;
 
+    // obj may have been allocated black during an incremental collection.
+    write_barrier(obj, car);
+    write_barrier(obj, cdr);
+
     return obj;
 }
 
@@ -192,21 +286,20 @@ LispObject * b_cons(LispObject * car, LispObject * cdr) {
 // get_obj
 // Construct a Lisp object.
 LispObject * get_obj(LispType type) {
-    // TODO: for now we just invoke GC when the total number of objects exceeds
-    // some value, but there are certainly better ways to do it
-    if (weakrefs_count > 1000)
-	collect_garbage();
+    // Collect if the heap has outgrown gc_heap_limit or the nursery is full.
+    maybe_collect_garbage();
+
+    return init_obj(heap_alloc(type), type);
+}
 
-    LispObject * obj = malloc(sizeof(LispObject));
 
+// init_obj
+// Initialize a newly allocated object.
+LispObject * init_obj(LispObject * obj, LispType type) {
     obj->type = type;
     obj->is_list = false;
-    obj->marked = false;
-
-    obj->weakref = weakrefs_head;
-    weakrefs_head = obj;
-    ++weakrefs_count;
 
+    color_new_obj(obj);
     return obj;
 }
 
@@ -262,6 +355,21 @@ void make_bool_builtin_2(char * name_str,
 }
 
 
+// make_builtin_n
+// Make a builtin that takes from min_args to max_args arguments, or any
+// number from min_args up if max_args is -1.
+void make_builtin_n(char * name_str,
+		    LispObject * (* b_func_n)(long args, long arg_count),
+		    long min_args, long max_args) {
+    ASSERT(min_args >= 0 && (max_args == -1 || max_args >= min_args));
+
+    LispObject * obj = get_builtin(name_str, TYPE_BUILTIN_N);
+    obj->b_func_n = b_func_n;
+    obj->min_args = min_args;
+    obj->max_args = max_args;
+}
+
+
 // ============================================================================
 // car, cdr, and length
 // ============================================================================
@@ -269,7 +377,7 @@ void make_bool_builtin_2(char * name_str,
 // b_car
 // Builtin Lisp function car.
 LispObject * b_car(LispObject * obj) {
-    if (!typecheck(obj, LISP_PAIR_PRED_SYM))
+    if (!check_type(obj, TYPE_PAIR, LISP_PAIR_PRED_SYM))
     	return NULL;
     return obj->car;
 }
@@ -278,7 +386,7 @@ LispObject * b_car(LispObject * obj) {
 // b_cdr
 // Builtin Lisp function cdr.
 LispObject * b_cdr(LispObject * obj) {
-    if (!typecheck(obj, LISP_PAIR_PRED_SYM))
+    if (!check_type(obj, TYPE_PAIR, LISP_PAIR_PRED_SYM))
     	return NULL;
     return obj->cdr;
 }
@@ -305,11 +413,7 @@ LispObject * cdr(LispObject * obj) {
 LispObject * b_length(LispObject * obj) {
     if (!typecheck(obj, LISP_LIST_PRED_SYM))
 	return NULL;
-
-    push(obj);  // Protect obj from GC that could be triggered by get_int.
-    LispObject * result = get_int(length(obj));
-    pop();
-    return result;
+    return get_int(length(obj));
 }
 
 
@@ -335,49 +439,61 @@ bool b_null_pred(LispObject * obj) {
 }
 
 
+// int_value
+// Return the value of a tagged or heap-allocated Lisp int.
+long int_value(LispObject * obj) {
+    if (is_fixnum(obj))
+	return fixnum_value(obj);
+    ASSERT(obj->type == TYPE_INT);
+    return obj->value;
+}
+
+
 // b_int_pred
 // Builtin Lisp function int?.
 bool b_int_pred(LispObject * obj) {
-    return obj->type == TYPE_INT;
+    return get_type(obj) == TYPE_INT;
 }
 
 
 // b_symbol_pred
 // Builtin Lisp function symbol?.
 bool b_symbol_pred(LispObject * obj) {
-    return obj->type == TYPE_SYM;
+    return get_type(obj) == TYPE_SYM;
 }
 
 
 // b_pair_pred
 // Builtin Lisp function pair?.
 bool b_pair_pred(LispObject * obj) {
-    return obj->type == TYPE_PAIR;
+    return get_type(obj) == TYPE_PAIR;
 }
 
 
 // b_list_pred
 // Builtin Lisp function list?.
 bool b_list_pred(LispObject * obj) {
-    return obj->is_list;
+    return !is_fixnum(obj) && obj->is_list;
 }
 
 
 // b_function_pred
 // Builtin Lisp function function?.
 bool b_function_pred(LispObject * obj) {
-    return obj->type == TYPE_LAMBDA || is_builtin(obj);
+    return get_type(obj) == TYPE_LAMBDA || is_builtin(obj);
 }
 
 
 // is_builtin
 // Return whether the object is a builtin Lisp function.
 bool is_builtin(LispObject * obj) {
-    return obj->type == TYPE_BUILTIN_0
-	|| obj->type == TYPE_BUILTIN_1
-	|| obj->type == TYPE_BUILTIN_2
-	|| obj->type == TYPE_BOOL_BUILTIN_1
-	|| obj->type == TYPE_BOOL_BUILTIN_2;
+    LispType type = get_type(obj);
+    return type == TYPE_BUILTIN_0
+	|| type == TYPE_BUILTIN_1
+	|| type == TYPE_BUILTIN_2
+	|| type == TYPE_BOOL_BUILTIN_1
+	|| type == TYPE_BOOL_BUILTIN_2
+	|| type == TYPE_BUILTIN_N;
 }
 
 
@@ -385,16 +501,56 @@ bool is_builtin(LispObject * obj) {
 // Miscellaneous utilities
 // ============================================================================
 
-bool get_config_bool(LispObject * obj) {
-    ASSERT(b_equal_pred(obj, LISP_STACK_OUTPUT)
-	   || b_equal_pred(obj, LISP_GC_OUTPUT));
+// get_config_name
+// Return the print name of the symbol that a special variable is bound to,
+// or NULL if the variable is bound to f or to something other than a symbol.
+char * get_config_name(LispObject * obj) {
+    ASSERT(obj == LISP_GC_LOG);
 
     LispObject * def = get_def(obj);
     ASSERT(def != NULL);
-    return to_bool(def);
+    return (b_symbol_pred(def) && def != LISP_F ? def->print_name : NULL);
+}
+
+
+// get_config_int
+// Return the value of an int special variable, or default_value if the
+// variable is bound to something other than an int.
+long get_config_int(LispObject * obj, long default_value) {
+    ASSERT(obj == LISP_GC_GROWTH_FACTOR
+	   || obj == LISP_GC_MIN_HEAP
+	   || obj == LISP_GC_NURSERY_SIZE
+	   || obj == LISP_GC_PAUSE_BUDGET
+	   || obj == LISP_GC_THREADS
+	   || obj == LISP_MAX_DEPTH);
+
+    LispObject * def = get_def(obj);
+    ASSERT(def != NULL);
+    return (b_int_pred(def) ? int_value(def) : default_value);
 }
 
 
 bool to_bool(LispObject * obj) {
     return (obj == LISP_F ? false : true);
 }
+
+
+// type_name
+// Return the name of a type, as used by gc-stats and print-trace.
+char * type_name(LispType type) {
+    static char * names[NUM_LISP_TYPES] = {
+	[TYPE_INT] = "int",
+	[TYPE_SYM] = "symbol",
+	[TYPE_UNIQUE] = "unique",
+	[TYPE_PAIR] = "pair",
+	[TYPE_LAMBDA] = "lambda",
+	[TYPE_BUILTIN_0] = "builtin-0",
+	[TYPE_BUILTIN_1] = "builtin-1",
+	[TYPE_BUILTIN_2] = "builtin-2",
+	[TYPE_BOOL_BUILTIN_1] = "bool-builtin-1",
+	[TYPE_BOOL_BUILTIN_2] = "bool-builtin-2",
+	[TYPE_BUILTIN_N] = "builtin-n",
+	[TYPE_FRAME] = "frame"
+    };
+    return names[type];
+}
@@ -6,7 +6,9 @@
 #define OBJ_H
 
 
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 
@@ -16,6 +18,12 @@
 
 typedef struct LispObjectStruct LispObject;
 
+// See ast.h.
+struct code;
+
+// See env.h.
+struct binding;
+
 typedef enum {
 	      TYPE_INT,
 	      TYPE_SYM,
@@ -26,22 +34,21 @@ typedef enum {
 	      TYPE_BUILTIN_1,
 	      TYPE_BUILTIN_2,
 	      TYPE_BOOL_BUILTIN_1,
-	      TYPE_BOOL_BUILTIN_2
+	      TYPE_BOOL_BUILTIN_2,
+	      TYPE_BUILTIN_N,
+	      TYPE_FRAME
 } LispType;
 
+#define NUM_LISP_TYPES (TYPE_FRAME + 1)
+
 
 // ============================================================================
 // Initial objects
 // ============================================================================
 
-// TODO: the comment below will become valid after object interning is
-// implemented. See the TODO in the mark function in gc.c.
-//
 // Each initial object must be protected from garbage collection unless it is a
-// name (symbol) that is bound in the global environment. Objects reachable
-// from the global environment are protected from garbage collection and there
-// is no way to delete a name from the global environment, so once a name has
-// been bound, it is permanently protected from garbage collection.
+// symbol. Symbols are interned (see intern.h) and interned symbols are never
+// garbage collected.
 
 // The empty list object.
 LispObject * LISP_EMPTY;
@@ -55,6 +62,9 @@ LispObject * LISP_QUOTE;
 LispObject * LISP_COND;
 LispObject * LISP_DEFINE;
 LispObject * LISP_LAMBDA;
+LispObject * LISP_AND;
+LispObject * LISP_OR;
+LispObject * LISP_NOT;
 
 // Symbols bound to builtin type predicate functions used by other builtin
 // functions to type-check arguments.
@@ -64,6 +74,14 @@ LispObject * LISP_INT_PRED_SYM;
 
 LispObject * LISP_GC_OUTPUT;
 LispObject * LISP_STACK_OUTPUT;
+LispObject * LISP_GC_GROWTH_FACTOR;
+LispObject * LISP_GC_MIN_HEAP;
+LispObject * LISP_GC_NURSERY_SIZE;
+LispObject * LISP_GC_PAUSE_BUDGET;
+LispObject * LISP_GC_THREADS;
+LispObject * LISP_GC_LOG;
+LispObject * LISP_MAX_DEPTH;
+LispObject * LISP_USE_BYTECODE;
 
 
 // ============================================================================
@@ -81,7 +99,15 @@ struct LispObjectStruct {
 	long value;
 
 	// TYPE_SYM
-	char * print_name;
+	struct {
+	    char * print_name;
+	    unsigned hash;
+	    LispObject * intern_next;
+
+	    // The symbol's binding in the global environment, or NULL if it
+	    // has never been bound.
+	    struct binding * binding;
+	};
 
 	// TYPE_PAIR
 	struct {
@@ -93,7 +119,13 @@ struct LispObjectStruct {
 	struct {
 	    LispObject * args;
 	    LispObject * body;
-	    LispObject * env_list;
+
+	    // The frame the lambda was created in, or the empty list if it was
+	    // created in the global environment.
+	    LispObject * env;
+
+	    // The analyzed body, which holds a reference to it.
+	    struct code * code;
 	};
 
 	struct {
@@ -113,17 +145,82 @@ struct LispObjectStruct {
 
 		// TYPE_BOOL_BUILTIN_2
 		bool (* b_bool_func_2)(LispObject *, LispObject *);
+
+		// TYPE_BUILTIN_N: the arguments are stack[args] to
+		// stack[args + arg_count - 1]. They are passed by index
+		// rather than by pointer because the stack may be reallocated.
+		LispObject * (* b_func_n)(long args, long arg_count);
 	    };
+
+	    // TYPE_BUILTIN_N: the fewest arguments it takes, and the most, or
+	    // -1 if there is no limit.
+	    long min_args;
+	    long max_args;
 	};
-    };
 
-    bool marked;
-    LispObject * weakref;
+	// TYPE_FRAME: the local variables of one function call. The values
+	// of the variables named by names follow slot_count, in the same
+	// order; see frame_slots.
+	struct {
+	    LispObject * parent;
+	    LispObject * names;
+	    long slot_count;
+	};
+    };
 };
 
 void make_initial_objs();
 
 
+// ----------------------------------------------------------------------------
+// Tagged ints
+// ----------------------------------------------------------------------------
+
+// Ints in the range FIXNUM_MIN to FIXNUM_MAX are not heap objects. Instead,
+// the value is encoded directly in the LispObject pointer: the value is
+// shifted left by one bit and the low bit is set. Heap objects are always at
+// least 2-byte aligned, so the low bit of a real object pointer is never set.
+// A tagged int must never be dereferenced; use get_type to get the type of an
+// object that may be a tagged int, and int_value to get the value of any int.
+//
+// Ints outside of this range are heap objects of type TYPE_INT.
+
+#define FIXNUM_TAG ((uintptr_t) 1)
+
+#define FIXNUM_MIN (LONG_MIN / 2)
+
+#define FIXNUM_MAX (LONG_MAX / 2)
+
+static inline bool is_fixnum(LispObject * obj) {
+    return ((uintptr_t) obj & FIXNUM_TAG) != 0;
+}
+
+static inline LispObject * make_fixnum(long value) {
+    return (LispObject *) (((uintptr_t) value << 1) | FIXNUM_TAG);
+}
+
+static inline long fixnum_value(LispObject * obj) {
+    // Arithmetic right shift restores the sign.
+    return (long) ((intptr_t) obj >> 1);
+}
+
+
+// ----------------------------------------------------------------------------
+// Frames
+// ----------------------------------------------------------------------------
+
+// A frame is allocated with room for its slots directly after its other
+// members, so a variable is found by indexing into the frame rather than by
+// searching it. Frames are only ever used by eval_node, never seen by Lisp
+// code.
+
+#define FRAME_MAX_SLOTS 512
+
+static inline LispObject ** frame_slots(LispObject * frame) {
+    return (LispObject **) (&frame->slot_count + 1);
+}
+
+
 // ----------------------------------------------------------------------------
 // Public constructors
 // ----------------------------------------------------------------------------
@@ -134,7 +231,10 @@ LispObject * get_sym(char * str);
 
 LispObject * get_sym_by_substr(char * str, long begin, long end);
 
-LispObject * get_lambda(LispObject * args, LispObject * body, LispObject * env_list);
+LispObject * get_lambda(struct code * code, LispObject * env);
+
+LispObject * get_frame(LispObject * parent, LispObject * names,
+		       long slot_count);
 
 LispObject * b_cons(LispObject * car, LispObject * cdr);
 
@@ -160,6 +260,12 @@ long length(LispObject * obj);
 // Type predicates
 // ============================================================================
 
+static inline LispType get_type(LispObject * obj) {
+    return (is_fixnum(obj) ? TYPE_INT : obj->type);
+}
+
+long int_value(LispObject * obj);
+
 bool b_null_pred(LispObject * obj);
 
 bool b_int_pred(LispObject * obj);
@@ -179,9 +285,13 @@ bool is_builtin(LispObject * obj);
 // Miscellaneous utilities
 // ============================================================================
 
-bool get_config_bool(LispObject * obj);
+long get_config_int(LispObject * obj, long default_value);
+
+char * get_config_name(LispObject * obj);
 
 bool to_bool(LispObject * obj);
 
+char * type_name(LispType type);
+
 
 #endif
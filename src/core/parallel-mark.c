@@ -0,0 +1,474 @@
+// parallel-mark.c
+// Source for parallel marking.
+
+
+// Sources:
+// - Chase and Lev, Dynamic Circular Work-Stealing Deque (SPAA 2005)
+// - Le et al., Correct and Efficient Work-Stealing for Weak Memory Models
+//   (PPoPP 2013)
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel-mark.h"
+#include "error.h"
+#include "heap.h"
+#include "trace.h"
+
+
+// ============================================================================
+// Work-stealing deques
+// ============================================================================
+
+// Each marking thread has a deque of objects that it still has to scan. The
+// thread that owns a deque pushes and pops objects at its bottom, and other
+// threads steal objects from its top.
+
+#define DEQUE_INITIAL_CAPACITY 1024
+
+struct deque_buffer {
+    long capacity;  // a power of 2
+    LispObject ** objs;
+
+    // Buffers that a deque has outgrown, which may still be read by threads
+    // that are stealing from it. They are freed after marking.
+    struct deque_buffer * prev;
+};
+
+struct deque {
+    // Keep deques that are owned by different threads in different cache
+    // lines.
+    _Alignas(64) long top;
+    long bottom;
+    struct deque_buffer * buffer;
+};
+
+
+// ============================================================================
+// Worker threads
+// ============================================================================
+
+struct worker {
+    pthread_t thread;
+    int id;
+
+    // The number of the last marking job the worker has seen.
+    unsigned long last_job;
+};
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+void init_deque(struct deque * deque);
+
+void deque_push(struct deque * deque, LispObject * obj);
+
+LispObject * deque_pop(struct deque * deque);
+
+LispObject * deque_steal(struct deque * deque, bool * lost_race);
+
+void grow_deque(struct deque * deque, long top, long bottom);
+
+void free_old_buffers(struct deque * deque);
+
+bool deque_is_empty(struct deque * deque);
+
+void start_workers(int threads);
+
+void forget_workers();
+
+void * worker_main(void * arg);
+
+void mark_in_thread(int id);
+
+LispObject * steal_work(int id);
+
+LispObject * scan_obj_parallel(LispObject * obj, struct deque * deque);
+
+
+// ============================================================================
+// Private variables
+// ============================================================================
+
+// One deque for each marking thread. Thread 0 is the thread that called
+// parallel_mark.
+struct deque deques[GC_MAX_THREADS];
+
+int deque_count;
+
+// The pool of worker threads, which are threads 1 to worker_count.
+struct worker workers[GC_MAX_THREADS];
+
+int worker_count;
+
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Signaled when a marking job starts, and when a worker finishes its part of
+// it.
+pthread_cond_t job_started = PTHREAD_COND_INITIALIZER;
+
+pthread_cond_t worker_finished = PTHREAD_COND_INITIALIZER;
+
+// Incremented for every marking job, so that a worker can tell a new job
+// from a spurious wakeup.
+unsigned long job_number;
+
+// The number of threads that take part in the current job, and the number
+// of workers that are done with it.
+int job_threads;
+
+int finished_workers;
+
+// The number of threads that have run out of work in the current job.
+// Marking is done when every thread has run out of work.
+int idle_threads;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// cpu_count
+// Return the number of online processors, which is the default value of
+// gc-threads.
+long cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0 ? count : 1);
+}
+
+
+// parallel_mark
+// Mark every object reachable from the given roots using the given number of
+// threads, including the calling thread.
+//
+// Pre:
+// - No other thread is running Lisp code or allocating objects.
+void parallel_mark(LispObject ** roots, long root_count, int threads) {
+    ASSERT(threads >= 1 && threads <= GC_MAX_THREADS);
+
+    while (deque_count < threads)
+	init_deque(&deques[deque_count++]);
+
+    // Deal out the roots, so that each thread starts with a share of the
+    // global environment and the stack.
+    for (long i = 0; i < root_count; ++i)
+	if (!is_fixnum(roots[i]))
+	    deque_push(&deques[i % threads], roots[i]);
+
+    start_workers(threads - 1);
+
+    pthread_mutex_lock(&pool_lock);
+    job_threads = threads;
+    finished_workers = 0;
+    __atomic_store_n(&idle_threads, 0, __ATOMIC_RELAXED);
+    ++job_number;
+    pthread_cond_broadcast(&job_started);
+    pthread_mutex_unlock(&pool_lock);
+
+    mark_in_thread(0);
+
+    pthread_mutex_lock(&pool_lock);
+    while (finished_workers < worker_count)
+	pthread_cond_wait(&worker_finished, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+
+    for (int i = 0; i < threads; ++i)
+	free_old_buffers(&deques[i]);
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+void init_deque(struct deque * deque) {
+    struct deque_buffer * buffer = malloc(sizeof(struct deque_buffer));
+    LispObject ** objs = malloc(DEQUE_INITIAL_CAPACITY * sizeof(LispObject *));
+    if (buffer == NULL || objs == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+    buffer->capacity = DEQUE_INITIAL_CAPACITY;
+    buffer->objs = objs;
+    buffer->prev = NULL;
+
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->buffer = buffer;
+}
+
+
+// deque_push
+// Push an object onto the bottom of a deque. Only the deque's owner may call
+// this.
+void deque_push(struct deque * deque, LispObject * obj) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= deque->buffer->capacity)
+	grow_deque(deque, top, bottom);
+
+    struct deque_buffer * buffer = deque->buffer;
+    __atomic_store_n(&buffer->objs[bottom & (buffer->capacity - 1)], obj,
+		     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+}
+
+
+// deque_pop
+// Pop an object from the bottom of a deque, or return NULL if the deque is
+// empty. Only the deque's owner may call this.
+LispObject * deque_pop(struct deque * deque) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    struct deque_buffer * buffer = deque->buffer;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+	return NULL;
+    }
+
+    LispObject * obj = __atomic_load_n(
+	&buffer->objs[bottom & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+    if (top == bottom) {
+	// This is the last object, so a thief may be taking it at the same
+	// time.
+	if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+					 __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+	    obj = NULL;
+	__atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return obj;
+}
+
+
+// deque_steal
+// Take an object from the top of another thread's deque. Return NULL if the
+// deque is empty or if another thread took the object first, in which case
+// lost_race is set.
+LispObject * deque_steal(struct deque * deque, bool * lost_race) {
+    long top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom)
+	return NULL;
+
+    struct deque_buffer * buffer = __atomic_load_n(&deque->buffer,
+						   __ATOMIC_ACQUIRE);
+    LispObject * obj = __atomic_load_n(
+	&buffer->objs[top & (buffer->capacity - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+				     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+	*lost_race = true;
+	return NULL;
+    }
+    return obj;
+}
+
+
+// grow_deque
+// Replace a full deque's buffer with one twice as large. The old buffer is
+// kept until marking is done, because thieves may still be reading it.
+void grow_deque(struct deque * deque, long top, long bottom) {
+    struct deque_buffer * old = deque->buffer;
+    struct deque_buffer * buffer = malloc(sizeof(struct deque_buffer));
+    LispObject ** objs = malloc(2 * old->capacity * sizeof(LispObject *));
+    if (buffer == NULL || objs == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
+    }
+    buffer->capacity = 2 * old->capacity;
+    buffer->objs = objs;
+    buffer->prev = old;
+
+    for (long i = top; i < bottom; ++i)
+	buffer->objs[i & (buffer->capacity - 1)]
+	    = old->objs[i & (old->capacity - 1)];
+
+    __atomic_store_n(&deque->buffer, buffer, __ATOMIC_RELEASE);
+}
+
+
+// free_old_buffers
+// Free the buffers that a deque has outgrown. Called once no thread can be
+// stealing from it.
+void free_old_buffers(struct deque * deque) {
+    struct deque_buffer * old = deque->buffer->prev;
+    struct deque_buffer * prev;
+    while (old != NULL) {
+	prev = old->prev;
+	free(old->objs);
+	free(old);
+	old = prev;
+    }
+    deque->buffer->prev = NULL;
+}
+
+
+bool deque_is_empty(struct deque * deque) {
+    return (__atomic_load_n(&deque->top, __ATOMIC_ACQUIRE)
+	    >= __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE));
+}
+
+
+// start_workers
+// Make sure the pool has at least the given number of worker threads.
+void start_workers(int count) {
+    static bool registered_fork_handler = false;
+    if (count > 0 && !registered_fork_handler) {
+	pthread_atfork(NULL, NULL, &forget_workers);
+	registered_fork_handler = true;
+    }
+
+    while (worker_count < count) {
+	// Worker i marks with deque i, starting with the next job.
+	struct worker * worker = &workers[worker_count];
+	worker->id = worker_count + 1;
+	worker->last_job = job_number;
+
+	pthread_mutex_lock(&pool_lock);
+	++worker_count;
+	pthread_mutex_unlock(&pool_lock);
+
+	if (pthread_create(&worker->thread, NULL, &worker_main, worker) != 0) {
+	    printf("\nCould not start a garbage collector thread.\n");
+	    exit(1);
+	}
+    }
+}
+
+
+// forget_workers
+// Empty the pool in a child process after fork. Only the thread that called
+// fork exists in the child, so the workers have to be started again.
+void forget_workers() {
+    worker_count = 0;
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&job_started, NULL);
+    pthread_cond_init(&worker_finished, NULL);
+}
+
+
+void * worker_main(void * arg) {
+    struct worker * worker = arg;
+
+    pthread_mutex_lock(&pool_lock);
+    while (true) {
+	while (job_number == worker->last_job)
+	    pthread_cond_wait(&job_started, &pool_lock);
+	worker->last_job = job_number;
+	int threads = job_threads;
+	pthread_mutex_unlock(&pool_lock);
+
+	if (worker->id < threads)
+	    mark_in_thread(worker->id);
+
+	pthread_mutex_lock(&pool_lock);
+	++finished_workers;
+	pthread_cond_signal(&worker_finished);
+    }
+    return NULL;
+}
+
+
+// mark_in_thread
+// Scan objects from the given thread's deque, stealing from the other
+// threads when it is empty, until every thread has run out of work.
+void mark_in_thread(int id) {
+    struct deque * deque = &deques[id];
+    LispObject * obj;
+    while (true) {
+	obj = deque_pop(deque);
+	if (obj == NULL)
+	    obj = steal_work(id);
+	if (obj == NULL)
+	    return;
+
+	// Follow a chain of cdrs without going through the deque.
+	while (obj != NULL)
+	    obj = scan_obj_parallel(obj, deque);
+    }
+}
+
+
+// steal_work
+// Steal an object from another thread. If there is nothing to steal, wait
+// until either another thread has work again or every thread is idle, in
+// which case return NULL.
+//
+// Only a thread that isn't idle pushes objects onto its deque, so once
+// every thread is idle, every deque is empty for good.
+LispObject * steal_work(int id) {
+    int threads = job_threads;
+    LispObject * obj;
+    bool lost_race;
+    bool idle = false;
+    while (true) {
+	lost_race = false;
+	for (int i = 1; i < threads; ++i) {
+	    struct deque * victim = &deques[(id + i) % threads];
+	    if (idle && deque_is_empty(victim))
+		continue;
+	    if (idle) {
+		__atomic_fetch_sub(&idle_threads, 1, __ATOMIC_SEQ_CST);
+		idle = false;
+	    }
+	    obj = deque_steal(victim, &lost_race);
+	    if (obj != NULL)
+		return obj;
+	}
+	if (lost_race)
+	    continue;
+
+	if (!idle) {
+	    __atomic_fetch_add(&idle_threads, 1, __ATOMIC_SEQ_CST);
+	    idle = true;
+	}
+	if (__atomic_load_n(&idle_threads, __ATOMIC_SEQ_CST) == threads)
+	    return NULL;
+	sched_yield();
+    }
+}
+
+
+// scan_obj_parallel
+// Like scan_obj in gc.c, but safe to run in several threads at once: mark an
+// object if no thread has marked it yet and push the objects it refers to
+// onto the given deque, except for one, which is returned.
+LispObject * scan_obj_parallel(LispObject * obj, struct deque * deque) {
+    if (is_fixnum(obj) || !try_mark(obj))
+	return NULL;
+
+    TRACE(trace_gc, TRACE_MARK, obj, 0);
+
+    if (b_pair_pred(obj)) {
+	if (!is_fixnum(obj->car))
+	    deque_push(deque, obj->car);
+	return obj->cdr;
+    }
+    if (obj->type == TYPE_LAMBDA) {
+	deque_push(deque, obj->args);
+	deque_push(deque, obj->body);
+	return obj->env;
+    }
+    if (obj->type == TYPE_FRAME) {
+	deque_push(deque, obj->names);
+	for (long i = 0; i < obj->slot_count; ++i)
+	    if (!is_fixnum(frame_slots(obj)[i]))
+		deque_push(deque, frame_slots(obj)[i]);
+	return obj->parent;
+    }
+    if (is_builtin(obj))
+	return obj->builtin_name;
+    return NULL;
+}
@@ -0,0 +1,38 @@
+// parallel-mark.h
+// Header for parallel marking.
+//
+// A full collection can mark the heap with several threads: the roots are
+// dealt out to the threads, each thread marks the objects reachable from its
+// roots, and a thread that runs out of work steals objects that another
+// thread still has to scan. Mark bits are set atomically with try_mark, so
+// each object is scanned by exactly one thread.
+//
+// The threads other than the calling thread are kept in a pool between
+// collections.
+
+
+#ifndef PARALLEL_MARK_H
+#define PARALLEL_MARK_H
+
+
+#include "obj.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// The most threads that marking will use, however large gc-threads is.
+#define GC_MAX_THREADS 64
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+long cpu_count();
+
+void parallel_mark(LispObject ** roots, long root_count, int threads);
+
+
+#endif
@@ -3,6 +3,7 @@
 #include "parse-eval.h"
 #include "parse.h"
 #include "error.h"
+#include "env.h"
 #include "eval.h"
 #include "stack.h"
 
@@ -12,8 +13,8 @@
 // ============================================================================
 
 void bad_stack() {
-    printf("\nAbort! Stack pointer is %ld but should be 0.\nStack contents: ",
-	   stack_ptr);
+    printf("\nAbort! Stack pointer is %ld and depth is %ld but both should be "
+	   "0.\nStack contents: ", stack_ptr, stack_depth);
     print_stack();
     printf("\n");
     FOUND_BUG;
@@ -32,13 +33,19 @@ LispObject * parse_eval(char * input_str) {
     // Stores the return values of parse and eval.
     LispObject * obj = NULL;
 
+    stack_max_depth = get_config_int(LISP_MAX_DEPTH, STACK_DEFAULT_MAX_DEPTH);
+    if (stack_max_depth <= 0)
+	stack_max_depth = STACK_DEFAULT_MAX_DEPTH;
+
+    eval_use_bytecode = to_bool(get_def(LISP_USE_BYTECODE));
+
     input_index = 0;
     skipspace();  // Meet parse's pre.
 
     if (input[input_index] != INPUT_END && input[input_index] != ';') {
 	obj = parse();
 
-	if (stack_ptr != 0)
+	if (stack_ptr != 0 || stack_depth != 0)
 	    bad_stack();
 
 	if (obj != NULL
@@ -55,14 +62,11 @@ LispObject * parse_eval(char * input_str) {
 	    // Meet eval's pre by protecting its first arg from GC.
 	    push(obj);
 
-	    // LISP_EMPTY is part of the initial set of objects protected
-	    // from GC, so it meets eval's pre that its second arg is
-	    // protected from GC.
-	    obj = eval(obj, LISP_EMPTY);
+	    obj = eval(obj);
 
 	    pop();
 
-	    if (stack_ptr != 0)
+	    if (stack_ptr != 0 || stack_depth != 0)
 		bad_stack();
 	}
     }
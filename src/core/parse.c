@@ -23,8 +23,6 @@ LispObject * parsesym();
 
 LispObject * parselist();
 
-long power(long b, long n);
-
 bool is_digit(char ch);
 
 bool is_sym_char(char ch);
@@ -93,8 +91,6 @@ void show_input_char() {
 // Private functions
 // ============================================================================
 
-// TODO: handle overflow
-//
 // parseint
 // Convert part of the input str to a Lisp int.
 //
@@ -129,25 +125,24 @@ LispObject * parseint() {
     	++input_index;
     }
     long end = input_index;
-    --input_index;
 
-    // Go back through the substr, adding up the values of the digits to get
-    // the overall value of the int.
+    // Add up the digits with the int's sign, so that the most negative int,
+    // whose magnitude is one more than the largest, can be read.
     long total = 0;
-    long place = 0;
     long digit;
-    while (input_index >= begin) {
-	digit = input[input_index] - 0x30;
-	total += digit * power(10, place);
-	++place;
-	--input_index;
+    for (input_index = begin; input_index < end; ++input_index) {
+	digit = input[input_index] - '0';
+	if (__builtin_mul_overflow(total, 10, &total)
+	    || __builtin_add_overflow(total, (positive ? digit : -digit),
+				      &total)) {
+	    show_input_char();
+	    printf("%snumber doesn't fit in an int\n", PARSE_ERR);
+	    return NULL;
+	}
     }
 
-    // Fulfill post.
-    input_index = end;
-    skipspace();
-
-    return get_int(positive ? total : -total);
+    skipspace();  // Fulfill post.
+    return get_int(total);
 }
 
 
@@ -186,6 +181,11 @@ LispObject * parsesym() {
 // parselist
 // Convert part of the input str to a Lisp list.
 //
+// The elements are parsed in a loop and kept in a frame on the stack, where
+// they are protected from GC, until the closing ')' is reached. So only
+// nested lists use the C stack, and each level of nesting counts towards
+// max-depth.
+//
 // Post:
 // - input[input_index] is the first non-space char after the parsed substr.
 //
@@ -194,56 +194,39 @@ LispObject * parsesym() {
 LispObject * parselist() {
     ASSERT(input[input_index] != ' ');
 
-    if (input[input_index] == ')') {
-	// Fulfill post.
-	++input_index;
-	skipspace();
-
-	// Return the empty list object.
-	return LISP_EMPTY;
-    }
-
-    if (input[input_index] == INPUT_END || input[input_index] == ';') {
-	show_input_char();
-	printf("%sincomplete list\n", PARSE_ERR);
-	return NULL;
-    }
-
-    LispObject * car = parse();
-
-    if (car == NULL)
+    long frame = push_frame(0);
+    if (frame == 0)
 	return NULL;
 
-    // Protect car from GC that could be triggered by parselist (when it calls
-    // parse, above).
-    push(car);
-
-    LispObject * cdr = parselist();
-
-    pop();
-
-    if (cdr == NULL)
-	return NULL;
-
-    LispObject * pair = b_cons(car, cdr);
-    return pair;
-}
+    LispObject * obj;
+    while (input[input_index] != ')') {
+	if (input[input_index] == INPUT_END || input[input_index] == ';') {
+	    show_input_char();
+	    printf("%sincomplete list\n", PARSE_ERR);
+	    pop_frame(frame);
+	    return NULL;
+	}
 
+	obj = parse();
+	if (obj == NULL) {
+	    pop_frame(frame);
+	    return NULL;
+	}
+	push(obj);
+    }
 
-// power
-// Return b to the power of n.
-long power(long b, long n) {
-    ASSERT(n >= 0);
+    // Fulfill post.
+    ++input_index;
+    skipspace();
 
-    if (n == 0)
-	return 1;
+    // Build the list back to front. Each element is still protected by the
+    // frame, and b_cons protects list.
+    LispObject * list = LISP_EMPTY;
+    for (long i = stack_ptr; i >= frame; --i)
+	list = b_cons(stack[i], list);
 
-    long total = b;
-    while (n > 1) {
-	total *= b;
-	--n;
-    }
-    return total;
+    pop_frame(frame);
+    return list;
 }
 
 
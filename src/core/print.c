@@ -14,6 +14,12 @@
 
 void print_pair(LispObject * obj);
 
+void print_rest(LispObject * obj, long i);
+
+void print_frames(LispObject * frame);
+
+void print_frame(LispObject * frame);
+
 
 // ============================================================================
 // Public functions
@@ -26,7 +32,7 @@ void print_obj(LispObject * obj) {
 	printf("()");
 
     else if (b_int_pred(obj))
-	printf("%ld", obj->value);
+	printf("%ld", int_value(obj));
 
     else if (b_symbol_pred(obj))
 	printf("%s", obj->print_name);
@@ -34,9 +40,9 @@ void print_obj(LispObject * obj) {
     else if (b_pair_pred(obj))
 	print_pair(obj);
 
-    else if (obj->type == TYPE_LAMBDA) {
+    else if (get_type(obj) == TYPE_LAMBDA) {
 	printf("#<function>[");
-	print_obj(obj->env_list);
+	print_frames(obj->env);
 	printf("]");
 	print_obj(obj->args);
 	printf("->");
@@ -49,6 +55,9 @@ void print_obj(LispObject * obj) {
 	printf(">");
     }
 
+    else if (get_type(obj) == TYPE_FRAME)
+	print_frames(obj);
+
     else {
 	FOUND_BUG;
     }
@@ -65,15 +74,16 @@ void print_pair(LispObject * obj) {
     ASSERT(b_pair_pred(obj));
 
     printf("(");
+    print_obj(car(obj));
+    print_rest(cdr(obj), 0);
+}
 
-    long i = 0;
-    while (true) {
-	print_obj(car(obj));
-	obj = cdr(obj);
-
-	if (!b_pair_pred(obj))
-	    break;
 
+// print_rest
+// Finish printing a chain of Lisp pairs, given the cdr of the pair whose car
+// was printed last and the number of car values printed before that one.
+void print_rest(LispObject * obj, long i) {
+    while (b_pair_pred(obj)) {
 	printf(" ");
 
 	++i;
@@ -81,6 +91,9 @@ void print_pair(LispObject * obj) {
 	    printf("...");
 	    return;
 	}
+
+	print_obj(car(obj));
+	obj = cdr(obj);
     }
 
     if (!b_null_pred(obj)) {
@@ -90,3 +103,56 @@ void print_pair(LispObject * obj) {
 
     printf(")");
 }
+
+
+// print_frames
+// Print a frame and the frames enclosing it as a list of local environments,
+// innermost first, where each local environment is a list of
+// (name . value) pairs. The global environment is printed as ().
+void print_frames(LispObject * frame) {
+    if (b_null_pred(frame)) {
+	printf("()");
+	return;
+    }
+
+    printf("(");
+    while (true) {
+	print_frame(frame);
+	frame = frame->parent;
+
+	if (b_null_pred(frame))
+	    break;
+
+	printf(" ");
+    }
+    printf(")");
+}
+
+
+// print_frame
+// Print a frame's variables as a list of (name . value) pairs, last variable
+// first. Each pair is printed the way print_pair would print it.
+void print_frame(LispObject * frame) {
+    ASSERT(get_type(frame) == TYPE_FRAME);
+
+    if (frame->slot_count == 0) {
+	printf("()");
+	return;
+    }
+
+    printf("(");
+    LispObject * names;
+    for (long i = frame->slot_count - 1; i >= 0; --i) {
+	names = frame->names;
+	for (long j = 0; j < i; ++j)
+	    names = cdr(names);
+
+	printf("(");
+	print_obj(car(names));
+	print_rest(frame_slots(frame)[i], 0);
+
+	if (i > 0)
+	    printf(" ");
+    }
+    printf(")");
+}
@@ -3,61 +3,84 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "env.h"
 #include "error.h"
 #include "obj.h"
 #include "print.h"
 #include "stack.h"
-
-
-// ============================================================================
-// Private functions
-// ============================================================================
-
-bool stack_output() {
-    return get_config_bool(LISP_STACK_OUTPUT);
-}
+#include "trace.h"
 
 
 // ============================================================================
 // Public functions
 // ============================================================================
 
-// push
-// Push an object to the stack.
-void push(LispObject * obj) {
-    if (stack_ptr >= STACK_SIZE - 1) {
-	printf("\nStack overflow.\n");
+// init_stack
+// Allocate an empty stack.
+void init_stack() {
+    stack_size = STACK_INITIAL_SIZE;
+    stack = malloc(stack_size * sizeof(LispObject *));
+    if (stack == NULL) {
+	printf("\nOut of memory.\n");
 	exit(1);
     }
+    stack_ptr = 0;
+    stack_depth = 0;
+    stack_max_depth = STACK_DEFAULT_MAX_DEPTH;
+}
 
-    ++stack_ptr;
-    stack[stack_ptr] = obj;
 
-    if (stack_output()) {
-	printf("push  ");
-	print_stack();
-	printf("\n");
+// grow_stack
+// Double the size of the stack. Called by push when the stack is full.
+void grow_stack() {
+    stack_size *= 2;
+    stack = realloc(stack, stack_size * sizeof(LispObject *));
+    if (stack == NULL) {
+	printf("\nOut of memory.\n");
+	exit(1);
     }
 }
 
 
-// pop
-// Decrement the stack pointer.
-void pop() {
-    if (stack_ptr <= 0) {
-	printf("\nStack underflow.\n");
-	exit(1);
+// push_frame
+// Push a frame of size slots, each holding the empty list, and return the
+// index of its first slot. Objects pushed with push while the frame is on top
+// of the stack belong to the frame too.
+//
+// On error:
+// - If there are already stack_max_depth frames on the stack, print an error
+//   message and return 0.
+long push_frame(long size) {
+    ASSERT(size >= 0);
+
+    if (stack_depth >= stack_max_depth) {
+	printf("Recursion too deep: max-depth is %ld\n", stack_max_depth);
+	return 0;
     }
 
-    --stack_ptr;
+    while (stack_ptr + size >= stack_size - 1)
+	grow_stack();
 
-    if (stack_output()) {
-	printf("pop   ");
-	print_stack();
-	printf("\n");
-    }
+    long frame = stack_ptr + 1;
+    for (long i = 0; i < size; ++i)
+	stack[frame + i] = LISP_EMPTY;
+    stack_ptr += size;
+    ++stack_depth;
+    TRACE(trace_stack, TRACE_PUSH_FRAME, NULL, stack_ptr);
+    return frame;
+}
+
+
+// pop_frame
+// Pop a frame and every object pushed since it was pushed.
+void pop_frame(long frame) {
+    ASSERT(stack_depth > 0 && frame > 0 && frame <= stack_ptr + 1);
+
+    stack_ptr = frame - 1;
+    --stack_depth;
+    TRACE(trace_stack, TRACE_POP_FRAME, NULL, stack_ptr);
 }
 
 
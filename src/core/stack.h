@@ -4,25 +4,103 @@
 // The purpose of the stack is to store objects that must be temporarily
 // protected from garbage collection. I got this idea from uLisp:
 // http://www.ulisp.com/show?1BD3
+//
+// The stack grows as needed, so it is reallocated from time to time: refer
+// to a slot by its index, never by a pointer into the stack.
+//
+// A function that needs several slots registers a frame with push_frame and
+// releases all of its slots at once with pop_frame. Frames are pushed once
+// per level of C recursion by eval and the parser, so the number of frames is
+// limited by max-depth, and exceeding it is an ordinary error rather than a
+// crash. Single objects can also be pushed and popped with push and pop,
+// which don't check the limit; the virtual machine uses them for the calls it
+// makes, which don't recurse in C.
 
 
 #ifndef STACK_H
 #define STACK_H
 
 
-#define STACK_SIZE 1024
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "obj.h"
+#include "trace.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+#define STACK_INITIAL_SIZE 1024
 
+#define STACK_DEFAULT_MAX_DEPTH 10000
 
-LispObject * stack[STACK_SIZE];
+
+// ============================================================================
+// Global variables
+// ============================================================================
+
+// The slots in use are stack[1] to stack[stack_ptr].
+LispObject ** stack;
 
 long stack_ptr;
 
+long stack_size;
+
+// The number of frames on the stack, and the most there can be. parse_eval
+// sets stack_max_depth from max-depth.
+long stack_depth;
+
+long stack_max_depth;
+
 
-void push(LispObject * obj);
+// ============================================================================
+// Public functions
+// ============================================================================
 
-void pop();
+void init_stack();
+
+void grow_stack();
+
+long push_frame(long size);
+
+void pop_frame(long frame);
 
 void print_stack();
 
 
+// push
+// Push an object to the stack.
+static inline void push(LispObject * obj) {
+    if (stack_ptr >= stack_size - 1)
+	grow_stack();
+
+    ++stack_ptr;
+    stack[stack_ptr] = obj;
+    TRACE(trace_stack, TRACE_PUSH, obj, stack_ptr);
+}
+
+
+// pop
+// Decrement the stack pointer.
+static inline void pop() {
+    if (stack_ptr <= 0) {
+	printf("\nStack underflow.\n");
+	exit(1);
+    }
+
+    --stack_ptr;
+    TRACE(trace_stack, TRACE_POP, NULL, stack_ptr);
+}
+
+
+// pop_n
+// Pop count objects.
+static inline void pop_n(long count) {
+    for (long i = 0; i < count; ++i)
+	pop();
+}
+
+
 #endif
@@ -0,0 +1,107 @@
+// trace.c
+// Source for debug tracing.
+
+
+#include <stdio.h>
+
+#include "trace.h"
+
+
+// ============================================================================
+// Private variables
+// ============================================================================
+
+struct trace_event trace_buffer[TRACE_BUFFER_SIZE];
+
+// The number of events ever recorded. Event i is stored at index
+// i % TRACE_BUFFER_SIZE. Marking threads record events concurrently, so each
+// one claims its index with an atomic increment instead of a lock.
+unsigned long trace_count;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// update_trace_flags
+// Update the cached tracing flags after sym has been bound to def. Called by
+// bind for every binding.
+void update_trace_flags(LispObject * sym, LispObject * def) {
+    if (sym == LISP_GC_OUTPUT)
+	trace_gc = to_bool(def);
+    else if (sym == LISP_STACK_OUTPUT)
+	trace_stack = to_bool(def);
+}
+
+
+// trace_event
+// Record an event in the ring buffer. Use the TRACE macro instead of calling
+// this directly, so that the call is skipped when tracing is off.
+void trace_event(TraceEventKind kind, LispObject * obj, long arg) {
+    unsigned long i = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+    struct trace_event * event = &trace_buffer[i & (TRACE_BUFFER_SIZE - 1)];
+    event->kind = kind;
+    event->type = (obj != NULL ? get_type(obj) : TYPE_UNIQUE);
+    event->obj = obj;
+    event->arg = arg;
+}
+
+
+// b_print_trace
+// Builtin Lisp function print-trace. Print the events in the ring buffer,
+// oldest first, and empty it.
+LispObject * b_print_trace() {
+    static char * kind_names[] = {
+	[TRACE_PUSH] = "push",
+	[TRACE_POP] = "pop",
+	[TRACE_PUSH_FRAME] = "push-frame",
+	[TRACE_POP_FRAME] = "pop-frame",
+	[TRACE_MARK] = "mark",
+	[TRACE_FREE] = "free",
+	[TRACE_GC_START] = "gc-start",
+	[TRACE_SWEEP_START] = "sweep-start",
+	[TRACE_GC_END] = "gc-end"
+    };
+
+    unsigned long count = trace_count;
+    unsigned long first = (count > TRACE_BUFFER_SIZE
+			   ? count - TRACE_BUFFER_SIZE : 0);
+    if (first > 0)
+	printf("(%lu older events overwritten)\n", first);
+
+    struct trace_event * event;
+    for (unsigned long i = first; i < count; ++i) {
+	event = &trace_buffer[i & (TRACE_BUFFER_SIZE - 1)];
+	printf("%-11s", kind_names[event->kind]);
+	switch (event->kind) {
+	case TRACE_PUSH:
+	case TRACE_MARK:
+	case TRACE_FREE:
+	    printf(" %-14s", type_name(event->type));
+	    if (is_fixnum(event->obj))
+		printf(" %ld", fixnum_value(event->obj));
+	    else
+		printf(" %p", event->obj);
+	    break;
+	default:
+	    break;
+	}
+	switch (event->kind) {
+	case TRACE_PUSH:
+	case TRACE_POP:
+	case TRACE_PUSH_FRAME:
+	case TRACE_POP_FRAME:
+	    printf(" depth %ld", event->arg);
+	    break;
+	case TRACE_GC_START:
+	    printf(" %s", (event->arg ? "minor" : "full"));
+	    break;
+	default:
+	    break;
+	}
+	printf("\n");
+    }
+
+    trace_count = 0;
+    return LISP_EMPTY;
+}
@@ -0,0 +1,80 @@
+// trace.h
+// Header for debug tracing.
+//
+// Tracepoints in the garbage collector and the stack record events in an
+// in-memory ring buffer, which print-trace prints. Whether each group of
+// tracepoints is on is cached in a flag that bind updates when gc-output or
+// stack-output is defined, so a tracepoint that is off only tests a global
+// bool. Building with -DLISP_DISABLE_TRACE removes the tracepoints entirely.
+
+
+#ifndef TRACE_H
+#define TRACE_H
+
+
+#include "obj.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// The number of events the ring buffer holds. Must be a power of 2. Once the
+// buffer is full, each new event overwrites the oldest one.
+#define TRACE_BUFFER_SIZE (64 * 1024)
+
+#ifdef LISP_DISABLE_TRACE
+#define TRACE(FLAG, KIND, OBJ, ARG) ((void) 0)
+#else
+#define TRACE(FLAG, KIND, OBJ, ARG)			\
+    do {						\
+	if (FLAG)					\
+	    trace_event((KIND), (OBJ), (ARG));		\
+    } while (0)
+#endif
+
+
+// ============================================================================
+// Events
+// ============================================================================
+
+typedef enum {
+	      TRACE_PUSH,          // arg: the new stack pointer
+	      TRACE_POP,           // arg: the new stack pointer
+	      TRACE_PUSH_FRAME,    // arg: the new stack pointer
+	      TRACE_POP_FRAME,     // arg: the new stack pointer
+	      TRACE_MARK,
+	      TRACE_FREE,
+	      TRACE_GC_START,      // arg: 1 for a minor collection, else 0
+	      TRACE_SWEEP_START,
+	      TRACE_GC_END
+} TraceEventKind;
+
+struct trace_event {
+    TraceEventKind kind;
+
+    // The object's type and address are recorded instead of the object
+    // itself, which may have been freed by the time the event is printed.
+    LispType type;
+    void * obj;
+    long arg;
+};
+
+// Cached values of gc-output and stack-output.
+bool trace_gc;
+
+bool trace_stack;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+void update_trace_flags(LispObject * sym, LispObject * def);
+
+void trace_event(TraceEventKind kind, LispObject * obj, long arg);
+
+LispObject * b_print_trace();
+
+
+#endif
@@ -0,0 +1,402 @@
+// vm.c
+// Source for the bytecode virtual machine.
+
+
+#include <stdio.h>
+
+#include "compile.h"
+#include "env.h"
+#include "error.h"
+#include "eval.h"
+#include "obj.h"
+#include "print.h"
+#include "stack.h"
+#include "vm.h"
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+// Jump straight to the code for the next instruction. Each instruction ends
+// with its own copy of this, which lets the processor predict where each one
+// is likely to go next much better than a single switch would.
+#define DISPATCH() __extension__ ({ goto * labels[* pc++]; })
+
+#define OPERAND(I) (pc[I])
+
+// The number of slots in a frame, before its operand stack.
+#define FRAME_SLOTS 4
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+// run_bytecode
+// Run bytecode in the given frame, and return the object that it returns.
+//
+// Pre:
+// - env and the objects the bytecode refers to are protected from garbage
+//   collection.
+// - env is the empty list or a frame, as described by eval_node's pre.
+//
+// On error:
+// - Return NULL.
+LispObject * run_bytecode(struct bytecode * bytecode, LispObject * env) {
+    static void * labels[NUM_OPCODES] = {
+	[OP_CONST] = __extension__ && op_const,
+	[OP_LOCAL] = __extension__ && op_local,
+	[OP_LOCAL_0] = __extension__ && op_local_0,
+	[OP_GLOBAL] = __extension__ && op_global,
+	[OP_DEFINE] = __extension__ && op_define,
+	[OP_LAMBDA] = __extension__ && op_lambda,
+	[OP_JUMP] = __extension__ && op_jump,
+	[OP_JUMP_IF_F] = __extension__ && op_jump_if_f,
+	[OP_AND_JUMP] = __extension__ && op_and_jump,
+	[OP_OR_JUMP] = __extension__ && op_or_jump,
+	[OP_NOT] = __extension__ && op_not,
+	[OP_CHECK_CALL] = __extension__ && op_check_call,
+	[OP_CALLEE] = __extension__ && op_callee,
+	[OP_CALL] = __extension__ && op_call,
+	[OP_TAIL_CALL] = __extension__ && op_tail_call,
+	[OP_RETURN] = __extension__ && op_return,
+	[OP_CALL_BUILTIN_1] = __extension__ && op_call_builtin_1,
+	[OP_CALL_BUILTIN_2] = __extension__ && op_call_builtin_2,
+	[OP_CALL_BUILTIN_N] = __extension__ && op_call_builtin_n,
+	[OP_CAR] = __extension__ && op_car,
+	[OP_CDR] = __extension__ && op_cdr,
+	[OP_CONS] = __extension__ && op_cons,
+	[OP_ADD] = __extension__ && op_add,
+	[OP_SUB] = __extension__ && op_sub,
+	[OP_LT] = __extension__ && op_lt
+    };
+
+    // Calls to lambdas don't recurse in C. Each one pushes a frame of
+    // FRAME_SLOTS slots on the stack, whose operand stack follows it, and
+    // returning pops it, so the depth of recursion is limited only by
+    // memory. The frame for bytecode itself is the base frame, which is
+    // pushed with push_frame and is the only one that counts towards
+    // max-depth. The slots of a frame are:
+    //
+    // - The function being run, which protects the objects its bytecode
+    //   refers to, or the empty list while bytecode itself is being run.
+    //   This is the slot that held the function on the caller's operand
+    //   stack, and it is replaced with the result on return.
+    // - The frame the function is run in.
+    // - The index of the caller's frame, as a tagged int.
+    // - Where to continue in the caller's code, as a tagged int.
+    long base = push_frame(FRAME_SLOTS);
+    if (base == 0)
+	return NULL;
+    stack[base + 1] = env;
+
+    long frame = base;
+    struct bytecode * base_bytecode = bytecode;
+    int * pc = bytecode->code;
+    LispObject ** constants = bytecode->constants;
+
+    LispObject * expr;
+    LispObject * func;
+    LispObject * obj;
+    LispObject * result;
+    struct call_cache * cache;
+    long arg_count;
+    long caller;
+    long offset;
+
+    DISPATCH();
+
+ op_const:
+    push(constants[OPERAND(0)]);
+    pc += 1;
+    DISPATCH();
+
+ op_local:
+    obj = env;
+    for (long i = OPERAND(0); i > 0; --i)
+	obj = obj->parent;
+    push(frame_slots(obj)[OPERAND(1)]);
+    pc += 2;
+    DISPATCH();
+
+ op_local_0:
+    push(frame_slots(env)[OPERAND(0)]);
+    pc += 1;
+    DISPATCH();
+
+ op_global:
+    expr = constants[OPERAND(0)];
+    obj = get_def(expr);
+    if (obj == NULL) {
+	INVALID_EXPR;
+	print_obj(expr);
+	printf(" is undefined\n");
+	goto error;
+    }
+    push(obj);
+    pc += 1;
+    DISPATCH();
+
+ op_define:
+    expr = constants[OPERAND(0)];
+    if (!bind(car(cdr(expr)), stack[stack_ptr], false)) {
+	INVALID_EXPR;
+	printf("Cannot redefine ");
+	print_obj(car(cdr(expr)));
+	printf("\n");
+    }
+    pc += 1;
+    DISPATCH();
+
+ op_lambda:
+    push(get_lambda(bytecode->lambdas[OPERAND(0)], env));
+    pc += 1;
+    DISPATCH();
+
+ op_jump:
+    pc = bytecode->code + OPERAND(0);
+    DISPATCH();
+
+ op_jump_if_f:
+    obj = stack[stack_ptr];
+    pop();
+    if (obj == LISP_F)
+	pc = bytecode->code + OPERAND(0);
+    else
+	pc += 1;
+    DISPATCH();
+
+ op_and_jump:
+    if (stack[stack_ptr] == LISP_F) {
+	pc = bytecode->code + OPERAND(0);
+	DISPATCH();
+    }
+    pop();
+    pc += 1;
+    DISPATCH();
+
+ op_or_jump:
+    if (stack[stack_ptr] != LISP_F) {
+	pc = bytecode->code + OPERAND(0);
+	DISPATCH();
+    }
+    pop();
+    pc += 1;
+    DISPATCH();
+
+ op_not:
+    stack[stack_ptr] = (stack[stack_ptr] == LISP_F ? LISP_T : LISP_F);
+    DISPATCH();
+
+ op_check_call:
+    expr = constants[OPERAND(1)];
+    if (!check_call(expr, stack[stack_ptr], OPERAND(0)))
+	goto error;
+    pc += 2;
+    DISPATCH();
+
+ op_callee:
+    cache = &bytecode->caches[OPERAND(2)];
+    if (cache->version == env_version) {
+	push(cache->func);
+	pc += 3;
+	DISPATCH();
+    }
+
+    expr = constants[OPERAND(1) + 1];
+    obj = get_def(expr);
+    if (obj == NULL) {
+	INVALID_EXPR;
+	print_obj(expr);
+	printf(" is undefined\n");
+	goto error;
+    }
+    push(obj);
+
+    expr = constants[OPERAND(1)];
+    if (!check_call(expr, obj, OPERAND(0)))
+	goto error;
+    cache->version = env_version;
+    cache->func = obj;
+    pc += 3;
+    DISPATCH();
+
+ op_call:
+    arg_count = OPERAND(0);
+    func = stack[stack_ptr - arg_count];
+
+    if (func->type != TYPE_LAMBDA) {
+	result = call_builtin(constants[OPERAND(1)], func, arg_count);
+	if (result == NULL)
+	    goto error;
+	pop_n(arg_count);
+    }
+    else {
+	// The arguments are replaced with the rest of func's frame.
+	obj = get_frame(func->env, func->args, arg_count);
+	pop_n(arg_count);
+	push(obj);
+	push(make_fixnum(frame));
+	push(make_fixnum(pc + 2 - bytecode->code));
+	frame = stack_ptr - (FRAME_SLOTS - 1);
+	env = obj;
+
+	bytecode = get_bytecode(func->code);
+	pc = bytecode->code;
+	constants = bytecode->constants;
+	DISPATCH();
+    }
+
+    stack[stack_ptr] = result;
+    pc += 2;
+    DISPATCH();
+
+ op_tail_call:
+    arg_count = OPERAND(0);
+    func = stack[stack_ptr - arg_count];
+
+    if (func->type != TYPE_LAMBDA) {
+	result = call_builtin(constants[OPERAND(1)], func, arg_count);
+	if (result == NULL)
+	    goto error;
+	goto done;
+    }
+
+    // Replace the bytecode being run, and the frame it's run in, with
+    // func's.
+    env = get_frame(func->env, func->args, arg_count);
+    stack[frame] = func;
+    stack[frame + 1] = env;
+    pop_n(stack_ptr - (frame + FRAME_SLOTS - 1));
+
+    bytecode = get_bytecode(func->code);
+    pc = bytecode->code;
+    constants = bytecode->constants;
+    DISPATCH();
+
+ op_return:
+    result = stack[stack_ptr];
+    goto done;
+
+ op_call_builtin_1:
+    arg_count = 1;
+    goto builtin;
+
+ op_call_builtin_2:
+    arg_count = 2;
+    goto builtin;
+
+ op_call_builtin_n:
+    arg_count = OPERAND(0);
+    result = call_builtin(constants[OPERAND(1)], constants[OPERAND(1) + 1],
+			  arg_count);
+    if (result == NULL)
+	goto error;
+    pop_n(arg_count);
+    push(result);
+    pc += 2;
+    DISPATCH();
+
+ op_car:
+    obj = stack[stack_ptr];
+    if (get_type(obj) != TYPE_PAIR) {
+	arg_count = 1;
+	goto builtin;
+    }
+    stack[stack_ptr] = obj->car;
+    pc += 1;
+    DISPATCH();
+
+ op_cdr:
+    obj = stack[stack_ptr];
+    if (get_type(obj) != TYPE_PAIR) {
+	arg_count = 1;
+	goto builtin;
+    }
+    stack[stack_ptr] = obj->cdr;
+    pc += 1;
+    DISPATCH();
+
+ op_cons:
+    obj = b_cons(stack[stack_ptr - 1], stack[stack_ptr]);
+    pop();
+    stack[stack_ptr] = obj;
+    pc += 1;
+    DISPATCH();
+
+ op_add:
+    if (!is_fixnum(stack[stack_ptr - 1]) || !is_fixnum(stack[stack_ptr])) {
+	arg_count = 2;
+	goto builtin;
+    }
+    // The sum of two tagged ints always fits in a long.
+    obj = get_int(fixnum_value(stack[stack_ptr - 1])
+		  + fixnum_value(stack[stack_ptr]));
+    pop();
+    stack[stack_ptr] = obj;
+    pc += 1;
+    DISPATCH();
+
+ op_sub:
+    if (!is_fixnum(stack[stack_ptr - 1]) || !is_fixnum(stack[stack_ptr])) {
+	arg_count = 2;
+	goto builtin;
+    }
+    obj = get_int(fixnum_value(stack[stack_ptr - 1])
+		  - fixnum_value(stack[stack_ptr]));
+    pop();
+    stack[stack_ptr] = obj;
+    pc += 1;
+    DISPATCH();
+
+ op_lt:
+    if (!is_fixnum(stack[stack_ptr - 1]) || !is_fixnum(stack[stack_ptr])) {
+	arg_count = 2;
+	goto builtin;
+    }
+    obj = (fixnum_value(stack[stack_ptr - 1]) < fixnum_value(stack[stack_ptr])
+	   ? LISP_T : LISP_F);
+    pop();
+    stack[stack_ptr] = obj;
+    pc += 1;
+    DISPATCH();
+
+ builtin:
+    // Also reached when an instruction for a builtin gets arguments it
+    // doesn't handle itself, so the builtin reports any type error.
+    result = call_builtin(constants[OPERAND(0)], constants[OPERAND(0) + 1],
+			  arg_count);
+    if (result == NULL)
+	goto error;
+    pop_n(arg_count - 1);
+    stack[stack_ptr] = result;
+    pc += 1;
+    DISPATCH();
+
+ done:
+    if (frame == base) {
+	pop_frame(base);
+	return result;
+    }
+
+    // Return to the caller, leaving the result in place of the function.
+    caller = fixnum_value(stack[frame + 2]);
+    offset = fixnum_value(stack[frame + 3]);
+    pop_n(stack_ptr - frame);
+    stack[frame] = result;
+    frame = caller;
+
+    func = stack[frame];
+    env = stack[frame + 1];
+    bytecode = (func == LISP_EMPTY ? base_bytecode : func->code->bytecode);
+    pc = bytecode->code + offset;
+    constants = bytecode->constants;
+    DISPATCH();
+
+ error:
+    // The frames of the calls being run are only slots above the base
+    // frame, so popping it pops them too.
+    pop_frame(base);
+    return NULL;
+}
@@ -0,0 +1,27 @@
+// vm.h
+// Header for the bytecode virtual machine.
+//
+// The virtual machine runs bytecode compiled by compile.c. Its operand stack
+// is the stack in stack.h, so every object it is working on is protected from
+// garbage collection. Its control stack is there too: a call to a lambda
+// pushes a few slots that record where to return to, rather than recursing
+// in C, so calls don't count towards max-depth and recursion is limited only
+// by memory. A tail call reuses its caller's slots.
+
+
+#ifndef VM_H
+#define VM_H
+
+
+#include "compile.h"
+#include "obj.h"
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+LispObject * run_bytecode(struct bytecode * bytecode, LispObject * env);
+
+
+#endif
@@ -1,10 +1,19 @@
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "builtins.h"
+#include "env.h"
 #include "obj.h"
 #include "error.h"
+#include "gc.h"
+#include "heap.h"
 #include "parse-eval.h"
+#include "parse.h"
 #include "setup.h"
+#include "stack.h"
+#include "trace.h"
 
 
 // TODO: assure GC doesn't run at all during tests, then run them all again w/
@@ -26,6 +35,26 @@ void test_parse_eval_negative_ints() {
 }
 
 
+void test_tagged_ints() {
+    ASSERT(parse_eval("42") == get_int(42));
+    ASSERT(is_fixnum(parse_eval("(+ 1 2)")));
+    ASSERT(int_value(get_int(FIXNUM_MIN)) == FIXNUM_MIN);
+    ASSERT(int_value(get_int(FIXNUM_MAX)) == FIXNUM_MAX);
+
+    // Ints outside of the tagged range are heap-allocated.
+    LispObject * big = get_int(FIXNUM_MAX + 1L);
+    ASSERT(!is_fixnum(big));
+    ASSERT(int_value(big) == FIXNUM_MAX + 1L);
+    ASSERT(b_equal_pred(big, get_int(FIXNUM_MAX + 1L)));
+    push(big);
+    push(get_int(1));
+    LispObject * difference = b_sub(stack_ptr - 1, 2);
+    pop_n(2);
+    ASSERT(b_equal_pred(difference, get_int(FIXNUM_MAX)));
+    ASSERT(is_fixnum(difference));
+}
+
+
 // TODO: remove this test after adding tests for quote with each object type
 void test_parse_eval_quoted_symbols() {
     ASSERT(b_equal_pred(parse_eval("(quote x)"), get_sym("x")));
@@ -33,6 +62,15 @@ void test_parse_eval_quoted_symbols() {
 }
 
 
+void test_interned_symbols() {
+    ASSERT(get_sym("foo") == get_sym("foo"));
+    ASSERT(get_sym("foo") != get_sym("foobar"));
+    ASSERT(parse_eval("(quote test-interned-symbol)")
+	   == get_sym("test-interned-symbol"));
+    ASSERT(parse_eval("(quote t)") == LISP_T);
+}
+
+
 void test_parse_eval_undefined_symbols() {
     ASSERT(parse_eval("x") == NULL);
     ASSERT(parse_eval("foo") == NULL);
@@ -43,6 +81,16 @@ void test_parse_eval_defined_symbols() {
     ASSERT(parse_eval("test-defined-symbol") == NULL);
     parse_eval("(define test-defined-symbol 500)");
     ASSERT(b_equal_pred(parse_eval("test-defined-symbol"), get_int(500)));
+
+    // A symbol's binding is made when it is first bound, and redefining it
+    // updates the same binding.
+    LispObject * sym = get_sym("test-defined-symbol");
+    struct binding * binding = sym->binding;
+    ASSERT(binding != NULL && binding->name == sym);
+    parse_eval("(define test-defined-symbol 501)");
+    ASSERT(sym->binding == binding);
+    ASSERT(get_def(sym) == get_int(501));
+    ASSERT(get_sym("test-never-defined-symbol")->binding == NULL);
 }
 
 
@@ -86,6 +134,763 @@ void test_parse_eval_builtin_function() {
 }
 
 
+void test_collect_garbage() {
+    parse_eval("(define test-gc-list (quote (1 2 3 (4 5) 6)))");
+    LispObject * kept = parse_eval("test-gc-list");
+
+    // Unreachable pairs.
+    for (long i = 0; i < 10000; ++i)
+	b_cons(get_int(i), LISP_EMPTY);
+
+    unsigned long count = heap_object_count;
+    collect_garbage();
+    ASSERT(heap_object_count < count);
+    ASSERT(parse_eval("test-gc-list") == kept);
+    ASSERT(b_equal_pred(kept, parse_eval("(quote (1 2 3 (4 5) 6))")));
+
+    // Freed slots are reused.
+    unsigned long pages = heap_page_count;
+    for (long i = 0; i < 1000; ++i)
+	b_cons(get_int(i), LISP_EMPTY);
+    ASSERT(heap_page_count == pages);
+}
+
+
+void test_gc_heap_limit() {
+    parse_eval("(define gc-growth-factor 300)");
+    parse_eval("(define gc-min-heap 0)");
+    collect_garbage();
+    ASSERT(gc_heap_limit == heap_bytes / 100 * 300);
+
+    parse_eval("(define gc-min-heap 100000000)");
+    collect_garbage();
+    ASSERT(gc_heap_limit == 100000000);
+
+    // Invalid values fall back to the defaults.
+    parse_eval("(define gc-growth-factor 50)");
+    parse_eval("(define gc-min-heap f)");
+    collect_garbage();
+    ASSERT(gc_heap_limit >= GC_DEFAULT_MIN_HEAP);
+
+    parse_eval("(define gc-growth-factor 200)");
+    parse_eval("(define gc-min-heap 1048576)");
+}
+
+
+// count_pauses
+// Return the number of pauses of the given kind in the pause histogram.
+unsigned long count_pauses(GCPauseKind kind) {
+    unsigned long count = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; ++i)
+	count += gc_pause_histogram[kind][i];
+    return count;
+}
+
+
+void test_collect_nursery() {
+    collect_garbage();
+
+    LispObject * pair = b_cons(get_int(1), LISP_EMPTY);
+    ASSERT(is_young(pair));
+
+    // A young object that is only referenced from the global environment
+    // survives a minor collection through the remembered set.
+    bind(get_sym("test-nursery-pair"), pair, false);
+    for (long i = 0; i < 10000; ++i)
+	b_cons(get_int(i), LISP_EMPTY);
+
+    unsigned long count = heap_object_count;
+    unsigned long pauses = count_pauses(GC_PAUSE_MINOR);
+    collect_nursery();
+    ASSERT(heap_object_count < count);
+    ASSERT(nursery_bytes == 0);
+    ASSERT(count_pauses(GC_PAUSE_MINOR) == pauses + 1);
+    ASSERT(!is_young(pair));
+    ASSERT(parse_eval("test-nursery-pair") == pair);
+    ASSERT(b_equal_pred(pair, parse_eval("(quote (1))")));
+}
+
+
+// Marking used to recurse on each cdr, so collecting a long list overflowed
+// the C stack.
+void test_mark_long_lists() {
+    for (long n = 1000000; n <= 4000000; n *= 2) {
+	LispObject * list = LISP_EMPTY;
+	push(list);
+	for (long i = 0; i < n; ++i) {
+	    list = b_cons(get_int(i), list);
+	    stack[stack_ptr] = list;
+	}
+
+	collect_garbage();
+	ASSERT(length(list) == n);
+	ASSERT(int_value(car(list)) == n - 1);
+
+	pop();
+	unsigned long count = heap_object_count;
+	collect_garbage();
+	ASSERT(heap_object_count <= count - n);
+    }
+}
+
+
+void test_incremental_gc() {
+    parse_eval("(define gc-pause-budget 1)");
+    parse_eval("(define gc-min-heap 0)");
+    collect_garbage();
+
+    // Build a list, and rebind a global to fresh pairs, while incremental
+    // collections run in slices between allocations.
+    LispObject * list = LISP_EMPTY;
+    push(list);
+    long cycles = 0;
+    GCPhase phase = gc_phase;
+    for (long i = 0; i < 1000000; ++i) {
+	list = b_cons(get_int(i), list);
+	stack[stack_ptr] = list;
+	if (i % 1000 == 0)
+	    bind(get_sym("test-incremental-pair"),
+		 b_cons(get_int(i), LISP_EMPTY), false);
+	b_cons(get_int(i), LISP_EMPTY);
+
+	if (phase != GC_IDLE && gc_phase == GC_IDLE)
+	    ++cycles;
+	phase = gc_phase;
+    }
+    ASSERT(cycles > 0);
+    ASSERT(length(list) == 1000000);
+    ASSERT(int_value(car(list)) == 999999);
+
+    // Incremental marking counts survivors as it goes, including objects
+    // allocated black.
+    unsigned long live = 0;
+    for (int t = 0; t < NUM_LISP_TYPES; ++t)
+	live += gc_stats.live_objects[t];
+    ASSERT(live == gc_stats.full_survivors);
+    ASSERT(gc_stats.live_objects[TYPE_PAIR] > 0);
+
+    // No minor collection fits in a budget of 1 microsecond, so the nursery
+    // is as small as it's allowed to get.
+    ASSERT(gc_nursery_limit == GC_MIN_NURSERY_SIZE);
+
+    pop();
+    ASSERT(b_equal_pred(parse_eval("test-incremental-pair"),
+			parse_eval("(quote (999000))")));
+    parse_eval("(define gc-pause-budget f)");
+    parse_eval("(define gc-min-heap 1048576)");
+    collect_garbage();
+    ASSERT(gc_phase == GC_IDLE);
+}
+
+
+void test_lazy_sweep() {
+    parse_eval("(define gc-min-heap 0)");
+    collect_garbage();
+    ASSERT(gc_phase == GC_IDLE);
+
+    LispObject * list = LISP_EMPTY;
+    push(list);
+    for (long i = 0; i < 1000; ++i) {
+	list = b_cons(get_int(i), list);
+	stack[stack_ptr] = list;
+    }
+
+    // A collection triggered by allocation returns before sweeping, and
+    // sweeping finishes as more objects are allocated.
+    while (gc_phase == GC_IDLE)
+	b_cons(get_int(0), LISP_EMPTY);
+    ASSERT(gc_phase == GC_SWEEPING);
+    long unswept = 0;
+    for (struct page * page = size_classes[SIZE_CLASS_PAIR].pages;
+	 page != NULL; page = page->next)
+	unswept += page_needs_sweep(page);
+    ASSERT(unswept > 0);
+    while (gc_phase == GC_SWEEPING)
+	b_cons(get_int(0), LISP_EMPTY);
+
+    ASSERT(length(list) == 1000);
+    ASSERT(int_value(car(list)) == 999);
+    pop();
+    parse_eval("(define gc-min-heap 1048576)");
+}
+
+
+void test_gc_stats() {
+    unsigned long full_collections = gc_stats.full_collections;
+    collect_garbage();
+    ASSERT(gc_stats.full_collections == full_collections + 1);
+    ASSERT(gc_stats.full_survivors == heap_object_count);
+    ASSERT(gc_stats.full_survivor_bytes == heap_bytes);
+    ASSERT(heap_peak_bytes >= heap_bytes);
+
+    unsigned long live = 0;
+    for (int t = 0; t < NUM_LISP_TYPES; ++t)
+	live += gc_stats.live_objects[t];
+    ASSERT(live == gc_stats.full_survivors);
+    ASSERT(gc_stats.live_objects[TYPE_SYM] > 0);
+    ASSERT(gc_stats.live_objects[TYPE_BUILTIN_1] > 0);
+
+    LispObject * stats = parse_eval("(gc-stats)");
+    ASSERT(car(car(stats)) == get_sym("full-collections"));
+    ASSERT(int_value(car(cdr(car(stats)))) == (long) gc_stats.full_collections);
+}
+
+
+void test_trace_flags() {
+    ASSERT(!trace_gc && !trace_stack);
+    parse_eval("(define gc-output t)");
+    ASSERT(trace_gc);
+    parse_eval("(define stack-output 1)");
+    ASSERT(trace_stack);
+    collect_garbage();
+    parse_eval("(define gc-output f)");
+    parse_eval("(define stack-output f)");
+    ASSERT(!trace_gc && !trace_stack);
+}
+
+
+void test_max_depth() {
+    // A literal list much longer than the stack used to be.
+    char * input = malloc(10 * 20000 + 32);
+    long n = sprintf(input, "(quote (");
+    for (long i = 0; i < 20000; ++i)
+	n += sprintf(input + n, "%ld ", i);
+    sprintf(input + n, "))");
+    LispObject * list = parse_eval(input);
+    ASSERT(length(list) == 20000);
+    ASSERT(int_value(car(list)) == 0);
+
+    parse_eval("(define count (lambda (n) "
+	       "(cond ((< n 1) 0) (t (+ 1 (count (- n 1)))))))");
+    ASSERT(int_value(parse_eval("(count 2000)")) == 2000);
+
+    // Going deeper than max-depth is an error, not a crash, and leaves the
+    // stack empty. Only the evaluator's calls count, since the virtual
+    // machine's don't use C stack.
+    parse_eval("(define max-depth 100)");
+    parse_eval("(define use-bytecode f)");
+    ASSERT(parse_eval("(count 1000)") == NULL);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+    parse_eval("(define use-bytecode t)");
+    n = 0;
+    for (long i = 0; i < 200; ++i)
+	input[n++] = '(';
+    for (long i = 0; i < 200; ++i)
+	input[n++] = ')';
+    input[n] = INPUT_END;
+    ASSERT(parse_eval(input) == NULL);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+    ASSERT(int_value(parse_eval("(count 10)")) == 10);
+
+    parse_eval("(define max-depth 10000)");
+    free(input);
+}
+
+
+void test_analyze() {
+    // Syntax errors in a lambda's body are found before anything is
+    // evaluated, even if the body would never run.
+    ASSERT(parse_eval("(define bad-body (lambda (x) (cond (t x) (x))))")
+	   == NULL);
+    ASSERT(parse_eval("bad-body") == NULL);
+    ASSERT(parse_eval("(cond (f (quote 1 2)) (t 3))") == NULL);
+    ASSERT(parse_eval("(lambda (x) (quote))") == NULL);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+
+    // Parameters shadow globals, and names that aren't parameters refer to
+    // globals even if they're defined after the lambda is.
+    parse_eval("(define shadow 1)");
+    parse_eval("(define get-shadow (lambda (shadow) (+ shadow later)))");
+    parse_eval("(define later 10)");
+    ASSERT(int_value(parse_eval("(get-shadow 5)")) == 15);
+
+    // A closure keeps its analyzed body after the expression that created
+    // it is gone.
+    parse_eval("(define make-adder (lambda (x) (lambda (y) (+ x y))))");
+    parse_eval("(define add3 (make-adder 3))");
+    collect_garbage();
+    ASSERT(int_value(parse_eval("(add3 4)")) == 7);
+    ASSERT(int_value(parse_eval("((make-adder 1) 2)")) == 3);
+    collect_garbage();
+    ASSERT(int_value(parse_eval("(add3 5)")) == 8);
+}
+
+
+void test_frames() {
+    // Inner parameters shadow outer ones, and each reference finds the
+    // innermost.
+    parse_eval("(define nest (lambda (x y) (lambda (x) (lambda (z) "
+	       "(cons x (cons y z))))))");
+    LispObject * result = parse_eval("(((nest 1 2) 3) 4)");
+    ASSERT(int_value(car(result)) == 3);
+    ASSERT(int_value(car(cdr(result))) == 2);
+    ASSERT(int_value(cdr(cdr(result))) == 4);
+
+    // Frames of different sizes, and frames kept alive only by closures.
+    parse_eval("(define five (lambda (a b c d e) "
+	       "(lambda () (+ a (+ b (+ c (+ d e)))))))");
+    parse_eval("(define sum-five (five 1 2 3 4 5))");
+    parse_eval("(define no-args (lambda () (lambda () 7)))");
+    parse_eval("(define seven (no-args))");
+    collect_garbage();
+    collect_garbage();
+    ASSERT(int_value(parse_eval("(sum-five)")) == 15);
+    ASSERT(int_value(parse_eval("(seven)")) == 7);
+
+    // A function can't have more parameters than a frame can hold.
+    char * input = malloc(8 * (FRAME_MAX_SLOTS + 1) + 32);
+    long n = sprintf(input, "(lambda (");
+    for (long i = 0; i <= FRAME_MAX_SLOTS; ++i)
+	n += sprintf(input + n, "p%ld ", i);
+    sprintf(input + n, ") 1)");
+    ASSERT(parse_eval(input) == NULL);
+    free(input);
+}
+
+
+// eval_both
+// Evaluate input with the tree-walking evaluator and with the bytecode
+// virtual machine, and check that both give the same result.
+void eval_both(char * input) {
+    parse_eval("(define use-bytecode f)");
+    LispObject * expected = parse_eval(input);
+
+    // parse_eval needs the stack to be empty, so protect expected from GC by
+    // binding it instead.
+    bind(get_sym("tree-result"), (expected == NULL ? LISP_EMPTY : expected),
+	 false);
+    parse_eval("(define use-bytecode t)");
+    LispObject * result = parse_eval(input);
+
+    if (expected == NULL || result == NULL) {
+	ASSERT(expected == NULL && result == NULL);
+    }
+    else if (!b_function_pred(expected)) {
+	ASSERT(b_equal_pred(expected, result));
+    }
+}
+
+
+void test_bytecode() {
+    parse_eval("(define fib (lambda (n) (cond ((< n 2) n) "
+	       "(t (+ (fib (- n 1)) (fib (- n 2)))))))");
+    parse_eval("(define rev (lambda (l acc) (cond ((null? l) acc) "
+	       "(t (rev (cdr l) (cons (car l) acc))))))");
+    parse_eval("(define adder (lambda (x) (lambda (y) (+ x y))))");
+
+    char * inputs[] = {
+	"(fib 15)",
+	"(rev (quote (1 2 3 4)) ())",
+	"((adder 3) 4)",
+	"(((lambda (a b) (lambda (c) (cons a (cons b c)))) 1 2) 3)",
+	"(cond ((null? 1) 1) ((equal? 2 2) (- 5 7)) (t 3))",
+	"(cond ((null? 1) 1))",
+	"(* (- 0 4611686018427387903) 1)",
+	"(+ 4611686018427387903 4611686018427387903)",
+	"(< (- 0 4611686018427387904) 0)",
+	"(and (int? 1) (or (symbol? 1) (pair? (quote (1)))))",
+	"(length (cdr (quote (1 2 3))))",
+	"(eval (quote (+ 1 2)))",
+	"(define defined-by-both (quote (x y)))",
+	// Errors.
+	"(car 1)",
+	"(+ 1 (quote a))",
+	"(< 1 (quote a))",
+	"(no-such-function 1)",
+	"((adder 1))",
+	"((adder 1) 1 2)",
+	"(1 2)",
+	"(cons 1)",
+	"(fib (car 1))",
+	"(cond ((car 1) 2))",
+	"(define t 1)",
+    };
+    for (unsigned i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+	eval_both(inputs[i]);
+
+    // A function that isn't a constant builtin is looked up at every call,
+    // so redefining it changes what compiled code calls.
+    parse_eval("(define op +)");
+    parse_eval("(define apply-op (lambda (x y) (op x y)))");
+    ASSERT(int_value(parse_eval("(apply-op 6 3)")) == 9);
+    parse_eval("(define op -)");
+    ASSERT(int_value(parse_eval("(apply-op 6 3)")) == 3);
+}
+
+
+void test_variadic_builtins() {
+    // Arithmetic and comparisons fold over any number of arguments.
+    ASSERT(parse_eval("(+)") == get_int(0));
+    ASSERT(parse_eval("(+ 1 2 3 4)") == get_int(10));
+    ASSERT(parse_eval("(- 5)") == get_int(-5));
+    ASSERT(parse_eval("(- 10 1 2 3)") == get_int(4));
+    ASSERT(parse_eval("(*)") == get_int(1));
+    ASSERT(parse_eval("(* 2 3 4)") == get_int(24));
+    ASSERT(parse_eval("(/ 100 5 2)") == get_int(10));
+    ASSERT(parse_eval("(< 1 2 3)") == LISP_T);
+    ASSERT(parse_eval("(< 1 3 2)") == LISP_F);
+    ASSERT(parse_eval("(< 1)") == LISP_T);
+    ASSERT(parse_eval("(<= 1 1 2)") == LISP_T);
+    ASSERT(parse_eval("(> 3 2 2)") == LISP_F);
+    ASSERT(parse_eval("(>= 3 2 2)") == LISP_T);
+    ASSERT(parse_eval("(= 2 2 2)") == LISP_T);
+    ASSERT(parse_eval("(= 2 2 3)") == LISP_F);
+
+    // Only the result is made into an int, however large the intermediate
+    // sums.
+    ASSERT(int_value(parse_eval("(+ 4611686018427387903 4611686018427387903 "
+				"(- 0 4611686018427387903))"))
+	   == 4611686018427387903L);
+
+    char * inputs[] = {
+	"(+ 1 2 3 4 5)",
+	"((lambda (x) (* x x x)) 3)",
+	"(apply-n + 1 2 3)",
+	"(apply-n < 3 2 1)",
+	"(cond ((< 1 2 3) (quote yes)))",
+	// Errors.
+	"(-)",
+	"(<)",
+	"(+ 1 2 (quote a))",
+	"(apply-n - (quote a) 1 2)",
+    };
+    parse_eval("(define apply-n (lambda (op x y z) (op x y z)))");
+    for (unsigned i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+	eval_both(inputs[i]);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+
+    // Like every builtin, the comparisons can't be redefined.
+    parse_eval("(define > (lambda (x y) f))");
+    ASSERT(parse_eval("(> 2 1)") == LISP_T);
+    ASSERT(is_builtin(parse_eval(">")));
+}
+
+
+void test_int_overflow() {
+    // Results that don't fit in a long are errors rather than wrapping
+    // around, however the evaluator reaches the builtin.
+    parse_eval("(define int-max (+ 4611686018427387903 4611686018427387904))");
+    parse_eval("(define int-min (- 0 int-max 1))");
+    ASSERT(int_value(parse_eval("int-max")) == LONG_MAX);
+    ASSERT(int_value(parse_eval("int-min")) == LONG_MIN);
+    ASSERT(int_value(parse_eval("(+ int-max int-min)")) == -1);
+    ASSERT(int_value(parse_eval("(/ int-min 2)")) == LONG_MIN / 2);
+
+    // So are literals that don't fit.
+    ASSERT(int_value(parse_eval("9223372036854775807")) == LONG_MAX);
+    ASSERT(int_value(parse_eval("-9223372036854775808")) == LONG_MIN);
+    ASSERT(parse_eval("9223372036854775808") == NULL);
+    ASSERT(parse_eval("-9223372036854775809") == NULL);
+    ASSERT(parse_eval("(+ 1 99999999999999999999)") == NULL);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+
+    char * inputs[] = {
+	"(+ int-max 1)",
+	"(+ 1 2 int-max)",
+	"(- int-min 1)",
+	"(- int-min)",
+	"(* int-max 2)",
+	"(* 2 3 int-min)",
+	"(/ int-min -1)",
+	"(/ 1 0)",
+	"(/ 0)",
+	"(/ 10 2 0)",
+	"((lambda (x) (+ x 1)) int-max)",
+    };
+    for (unsigned i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+	ASSERT(parse_eval(inputs[i]) == NULL);
+	eval_both(inputs[i]);
+    }
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+}
+
+
+void test_logic() {
+    // And and or evaluate to the operand that decided the result, and stop
+    // there, so the operands after it can be errors.
+    char * inputs[] = {
+	"(and)",
+	"(or)",
+	"(and 1)",
+	"(or f)",
+	"(and 1 2)",
+	"(and 1 f)",
+	"(and f 2)",
+	"(or 1 2)",
+	"(or f 2)",
+	"(or f f)",
+	"(and 1 2 3 4)",
+	"(or f f 3 4)",
+	"(and (quote a) () 0)",
+	"(and f (car 1))",
+	"(or 1 (car 1))",
+	"(and 1 f undefined-by-logic)",
+	"(not f)",
+	"(not ())",
+	"(not (and 1 f))",
+	"(cond ((or (null? 1) (int? 1)) 5))",
+	"(function? not)",
+	"((lambda (g x) (g x)) not f)",
+	"((lambda (g x) (g x)) not 1)",
+	// Errors.
+	"(and 1 (car 1))",
+	"(or f undefined-by-logic)",
+	"(not (car 1))",
+	"(not)",
+	"(not 1 2)",
+	"(and 1 (quote))",
+    };
+    for (unsigned i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i)
+	eval_both(inputs[i]);
+
+    char * modes[] = {"(define use-bytecode f)", "(define use-bytecode t)"};
+    for (int i = 0; i < 2; ++i) {
+	parse_eval(modes[i]);
+	ASSERT(parse_eval("(and)") == LISP_T);
+	ASSERT(parse_eval("(or)") == LISP_F);
+	ASSERT(parse_eval("(and 1 f)") == LISP_F);
+	ASSERT(int_value(parse_eval("(and 1 2 3)")) == 3);
+	ASSERT(int_value(parse_eval("(or f 2 3)")) == 2);
+	ASSERT(parse_eval("(or f f f)") == LISP_F);
+	ASSERT(parse_eval("(not ())") == LISP_F);
+	ASSERT(parse_eval("(not f)") == LISP_T);
+	ASSERT(parse_eval("(not)") == NULL);
+
+	// Not is also bound to a builtin, so it can be used as a value, but
+	// and and or aren't functions.
+	ASSERT(parse_eval("(function? not)") == LISP_T);
+	ASSERT(parse_eval("((lambda (g x) (g x)) not f)") == LISP_T);
+	ASSERT(parse_eval("((lambda (g x) (g x)) not 1)") == LISP_F);
+	ASSERT(parse_eval("(function? and)") == NULL);
+	ASSERT(parse_eval("(function? or)") == NULL);
+
+	// The builtin can't be redefined, and the special form doesn't look
+	// at the binding anyway.
+	parse_eval("(define not (lambda (x) x))");
+	ASSERT(parse_eval("(not f)") == LISP_T);
+	ASSERT(parse_eval("((lambda (g x) (g x)) not f)") == LISP_T);
+
+	// Operands after the one that decided the result aren't evaluated.
+	parse_eval("(define logic-effect 0)");
+	parse_eval("(and f (define logic-effect 1))");
+	parse_eval("(or 1 (define logic-effect 2))");
+	ASSERT(int_value(parse_eval("logic-effect")) == 0);
+	parse_eval("(and 1 (define logic-effect 3))");
+	ASSERT(int_value(parse_eval("logic-effect")) == 3);
+
+	// The last operand is in tail position.
+	parse_eval("(define max-depth 100)");
+	parse_eval("(define all-ints (lambda (n) "
+		   "(or (< n 1) (and (int? n) (all-ints (- n 1))))))");
+	ASSERT(parse_eval("(all-ints 100000)") == LISP_T);
+	parse_eval("(define max-depth 10000)");
+	ASSERT(stack_ptr == 0 && stack_depth == 0);
+    }
+}
+
+
+void test_call_caches() {
+    parse_eval("(define callee (lambda (x) (+ x 1)))");
+    parse_eval("(define caller (lambda (x) (callee x)))");
+
+    char * modes[] = {"(define use-bytecode f)", "(define use-bytecode t)"};
+    for (int i = 0; i < 2; ++i) {
+	parse_eval(modes[i]);
+	parse_eval("(define callee (lambda (x) (+ x 1)))");
+	ASSERT(parse_eval("(caller 1)") == get_int(2));
+	ASSERT(parse_eval("(caller 1)") == get_int(2));
+
+	// Binding anything makes every cached function stale, so a call
+	// site sees a redefinition straight away, even after the old
+	// function has been collected.
+	unsigned long version = env_version;
+	parse_eval("(define callee (lambda (x) (- x 1)))");
+	ASSERT(env_version > version);
+	collect_garbage();
+	ASSERT(parse_eval("(caller 1)") == get_int(0));
+	parse_eval("(define callee car)");
+	ASSERT(parse_eval("(caller (quote (5)))") == get_int(5));
+
+	// A function that check_call rejects isn't cached.
+	parse_eval("(define callee (lambda (x y) x))");
+	ASSERT(parse_eval("(caller 1)") == NULL);
+	ASSERT(parse_eval("(caller 1)") == NULL);
+	parse_eval("(define callee (lambda (x) x))");
+	ASSERT(parse_eval("(caller 7)") == get_int(7));
+	ASSERT(stack_ptr == 0 && stack_depth == 0);
+    }
+}
+
+
+void test_tail_calls() {
+    parse_eval("(define count-down (lambda (n) "
+	       "(cond ((< n 1) (quote done)) (t (count-down (- n 1))))))");
+    parse_eval("(define sum-to (lambda (n acc) "
+	       "(cond ((< n 1) acc) (t (sum-to (- n 1) (+ acc n))))))");
+    parse_eval("(define even (lambda (n) (cond ((< n 1) t) (t (odd (- n 1))))))");
+    parse_eval("(define odd (lambda (n) (cond ((< n 1) f) (t (even (- n 1))))))");
+
+    char * modes[] = {"(define use-bytecode f)", "(define use-bytecode t)"};
+    for (int i = 0; i < 2; ++i) {
+	parse_eval(modes[i]);
+
+	// Tail calls don't count towards max-depth, so loops of any length
+	// run in a fixed amount of C stack and stack.
+	parse_eval("(define max-depth 100)");
+	ASSERT(parse_eval("(count-down 10000000)") == get_sym("done"));
+	ASSERT(int_value(parse_eval("(sum-to 1000000 0)"))
+	       == 1000000L * 1000001L / 2);
+	ASSERT(parse_eval("(even 100001)") == LISP_F);
+	ASSERT(stack_ptr == 0 && stack_depth == 0);
+	parse_eval("(define max-depth 10000)");
+    }
+}
+
+
+void test_deep_recursion() {
+    // The virtual machine keeps its calls on the stack rather than the C
+    // stack, so recursion that isn't in tail position can go far deeper
+    // than max-depth.
+    parse_eval("(define count (lambda (n) "
+	       "(cond ((< n 1) 0) (t (+ 1 (count (- n 1)))))))");
+    ASSERT(int_value(parse_eval("(count 1000000)")) == 1000000);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+
+    parse_eval("(define build (lambda (n) "
+	       "(cond ((< n 1) ()) (t (cons n (build (- n 1)))))))");
+    parse_eval("(define sum (lambda (l) "
+	       "(cond ((null? l) 0) (t (+ (car l) (sum (cdr l)))))))");
+    bind(get_sym("deep-list"), parse_eval("(build 500000)"), false);
+    ASSERT(length(get_def(get_sym("deep-list"))) == 500000);
+    ASSERT(int_value(parse_eval("(sum deep-list)")) == 500000L * 500001L / 2);
+
+    // An error deep in the recursion unwinds all of it.
+    parse_eval("(define fail (lambda (n) "
+	       "(cond ((< n 1) (car n)) (t (+ 1 (fail (- n 1)))))))");
+    ASSERT(parse_eval("(fail 100000)") == NULL);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+
+    // Calls made by builtins still recurse in C, and still count.
+    parse_eval("(define max-depth 100)");
+    parse_eval("(define nest (lambda (n) "
+	       "(cond ((< n 1) 0) (t (+ 1 (eval (cons (quote nest) (cons (- n 1) ()))))))))");
+    ASSERT(parse_eval("(nest 1000)") == NULL);
+    ASSERT(stack_ptr == 0 && stack_depth == 0);
+    parse_eval("(define max-depth 10000)");
+    ASSERT(int_value(parse_eval("(nest 1000)")) == 1000);
+}
+
+
+void test_env_table() {
+    // The table grows to hold many bindings, and every one can still be
+    // found by searching it.
+    char name[32];
+    unsigned long count = env_count;
+    for (long i = 0; i < 100000; ++i) {
+	sprintf(name, "test-env-%ld", i);
+	bind(get_sym(name), get_int(i), false);
+    }
+    ASSERT(env_count == count + 100000);
+    ASSERT(env_count * 4 <= env_capacity * 3);
+    ASSERT((env_capacity & (env_capacity - 1)) == 0);
+
+    for (long i = 0; i < 100000; ++i) {
+	sprintf(name, "test-env-%ld", i);
+	LispObject * sym = get_sym(name);
+	ASSERT(find_binding(sym) == sym->binding);
+	ASSERT(get_def(sym) == get_int(i));
+    }
+    ASSERT(find_binding(get_sym("car"))->def == parse_eval("car"));
+    ASSERT(find_binding(get_sym("test-env-unbound")) == NULL);
+
+    // The bindings stay reachable, and are visited by the collector.
+    collect_garbage();
+    ASSERT(int_value(parse_eval("test-env-99999")) == 99999);
+}
+
+
+void test_heap_dump() {
+    parse_eval("(define test-dump-list (quote (1 2 3)))");
+    parse_eval("(define test-dump-pair (cons (quote a) 1))");
+    ASSERT(parse_eval("(heap-dump (quote /tmp/lisp-test-heap-dump))") != NULL);
+
+    // Every object has a line, and the list is a global root.
+    FILE * file = fopen("/tmp/lisp-test-heap-dump", "r");
+    ASSERT(file != NULL);
+    char line[256];
+    char expected[256];
+    sprintf(expected, "r global test-dump-list %p\n",
+	    (void *) get_def(get_sym("test-dump-list")));
+
+    // A tagged int is written as 0, so a pair always has its car and cdr.
+    LispObject * pair = get_def(get_sym("test-dump-pair"));
+    char expected_pair[256];
+    sprintf(expected_pair, "o %p pair %u %p 0\n", (void *) pair,
+	    obj_page(pair)->slot_size, (void *) pair->car);
+
+    unsigned long objs = 0;
+    bool found_root = false;
+    bool found_pair = false;
+    ASSERT(fgets(line, sizeof(line), file) != NULL);
+    ASSERT(strcmp(line, "lisp-heap-dump 2\n") == 0);
+    while (fgets(line, sizeof(line), file) != NULL) {
+	if (line[0] == 'o')
+	    ++objs;
+	if (strcmp(line, expected) == 0)
+	    found_root = true;
+	if (strcmp(line, expected_pair) == 0)
+	    found_pair = true;
+    }
+    fclose(file);
+    remove("/tmp/lisp-test-heap-dump");
+    ASSERT(objs == heap_object_count);
+    ASSERT(found_root);
+    ASSERT(found_pair);
+
+    ASSERT(parse_eval("(heap-dump 1)") == NULL);
+}
+
+
+LispObject * make_tree(long depth) {
+    if (depth == 0)
+	return get_int(depth);
+    push(make_tree(depth - 1));
+    LispObject * tree = b_cons(stack[stack_ptr], make_tree(depth - 1));
+    pop();
+    return tree;
+}
+
+
+void test_parallel_mark() {
+    // Trees give the marking threads work to steal from each other.
+    bind(get_sym("test-parallel-tree"), make_tree(16), false);
+    LispObject * list = LISP_EMPTY;
+    bind(get_sym("test-parallel-list"), list, false);
+    for (long i = 0; i < 100000; ++i) {
+	list = b_cons(get_int(i), list);
+	bind(get_sym("test-parallel-list"), list, false);
+    }
+
+    parse_eval("(define gc-threads 1)");
+    collect_garbage();
+    unsigned long count = heap_object_count;
+
+    parse_eval("(define gc-threads 4)");
+    for (int i = 0; i < 10; ++i) {
+	collect_garbage();
+	ASSERT(heap_object_count == count);
+	ASSERT(gc_stats.full_survivors == count);
+    }
+    ASSERT(length(parse_eval("test-parallel-list")) == 100000);
+    ASSERT(b_equal_pred(parse_eval("test-parallel-tree"), make_tree(16)));
+
+    parse_eval("(define test-parallel-tree f)");
+    parse_eval("(define test-parallel-list f)");
+    collect_garbage();
+    ASSERT(heap_object_count < count - 100000);
+}
+
+
 // TODO: add test_parse_eval functions for: closures, special forms, builtin
 // functions, and pre-defined Lisp functions
 
@@ -94,7 +899,9 @@ int main() {
     init_setup();
     test_parse_eval_positive_ints();
     test_parse_eval_negative_ints();
+    test_tagged_ints();
     test_parse_eval_quoted_symbols();
+    test_interned_symbols();
     test_parse_eval_undefined_symbols();
     test_parse_eval_defined_symbols();
     test_parse_eval_bool_symbols();
@@ -103,5 +910,26 @@ int main() {
     test_parse_eval_function_app();
     test_parse_eval_lambda_function();
     test_parse_eval_builtin_function();
+    test_collect_garbage();
+    test_gc_heap_limit();
+    test_collect_nursery();
+    test_mark_long_lists();
+    test_incremental_gc();
+    test_lazy_sweep();
+    test_gc_stats();
+    test_trace_flags();
+    test_max_depth();
+    test_analyze();
+    test_frames();
+    test_bytecode();
+    test_variadic_builtins();
+    test_int_overflow();
+    test_logic();
+    test_call_caches();
+    test_tail_calls();
+    test_deep_recursion();
+    test_env_table();
+    test_heap_dump();
+    test_parallel_mark();
     printf("\nAll tests PASSED.");
 }
@@ -0,0 +1,674 @@
+// heap-summary.c
+// Summarize a heap dump written by heap-dump.
+//
+// Usage: heap-summary FILE [COUNT]
+//
+// Print a census of the objects in the dump by type, then the COUNT (by
+// default 10) roots and objects that retain the most memory. The memory an
+// object retains is the memory in the objects that can only be reached
+// through it, which is what would be freed if it were. This is found from the
+// dominator tree of the object graph: object a dominates object b if every
+// path from the roots to b goes through a, and a retains exactly the objects
+// it dominates. The dominator tree is computed with the algorithm in Cooper,
+// Harvey, and Kennedy, "A Simple, Fast Dominance Algorithm".
+//
+// The format of heap dumps is described in src/core/heap-dump.h.
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// ============================================================================
+// Macros
+// ============================================================================
+
+#define LINE_SIZE 4096
+
+#define MAX_TYPES 64
+
+#define DEFAULT_COUNT 10
+
+// Node 0 of the object graph is a made-up object that refers to every root,
+// and object i is node i + 1.
+#define SUPER_ROOT 0
+
+
+// ============================================================================
+// Private function prototypes
+// ============================================================================
+
+void load_dump(char * file_name);
+
+void add_obj(uintptr_t addr, char * type, unsigned long size);
+
+void add_ref(uintptr_t addr);
+
+void add_root(char * kind, char * label, uintptr_t addr);
+
+int type_index(char * type);
+
+void resolve_refs();
+
+long find_node(uintptr_t addr);
+
+void compute_dominators();
+
+long intersect(long a, long b);
+
+void compute_retained();
+
+void print_census();
+
+void print_top_roots(long count);
+
+void print_top_objs(long count);
+
+int compare_roots(const void * a, const void * b);
+
+int compare_nodes(const void * a, const void * b);
+
+char * root_name(long root);
+
+void * grow(void * array, long capacity, size_t elem_size);
+
+char * copy_str(char * str);
+
+void fail(char * message);
+
+
+// ============================================================================
+// Private variables
+// ============================================================================
+
+// Objects, in the order they appear in the dump. Object i's references are
+// refs[ref_start[i]] to refs[ref_start[i + 1] - 1]; they are addresses until
+// resolve_refs turns them into node numbers, or -1 for references to objects
+// that aren't in the dump.
+uintptr_t * obj_addrs;
+
+int * obj_types;
+
+unsigned long * obj_sizes;
+
+long * ref_start;
+
+long obj_count;
+
+long obj_capacity;
+
+long * refs;
+
+long ref_count;
+
+long ref_capacity;
+
+char * type_names[MAX_TYPES];
+
+int type_count;
+
+// Roots. root_nodes is filled in by resolve_refs.
+char ** root_kinds;
+
+char ** root_labels;
+
+uintptr_t * root_addrs;
+
+long * root_nodes;
+
+long root_count;
+
+long root_capacity;
+
+// Open addressing hash table from addresses to node numbers.
+long * addr_table;
+
+unsigned long addr_table_size;
+
+// The node count is obj_count + 1, for the super root. postorder[i] is the
+// node that was finished i-th by a depth-first search from the super root,
+// and post_num is its inverse, with -1 for nodes the search didn't reach.
+long node_count;
+
+long * postorder;
+
+long * post_num;
+
+long reached_count;
+
+// Immediate dominator of each node, and the bytes and objects each node
+// retains.
+long * idom;
+
+unsigned long * retained_bytes;
+
+unsigned long * retained_objs;
+
+
+// ============================================================================
+// Public functions
+// ============================================================================
+
+int main(int argc, char ** argv) {
+    if (argc != 2 && argc != 3) {
+	fprintf(stderr, "Usage: %s FILE [COUNT]\n", argv[0]);
+	return 1;
+    }
+    long count = (argc == 3 ? atol(argv[2]) : DEFAULT_COUNT);
+
+    load_dump(argv[1]);
+    resolve_refs();
+    compute_dominators();
+    compute_retained();
+
+    print_census();
+    print_top_roots(count);
+    print_top_objs(count);
+    return 0;
+}
+
+
+// ============================================================================
+// Private functions
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// Loading
+// ----------------------------------------------------------------------------
+
+// load_dump
+// Read the objects and roots in a heap dump.
+void load_dump(char * file_name) {
+    FILE * file = fopen(file_name, "r");
+    if (file == NULL)
+	fail("could not open the heap dump");
+
+    char line[LINE_SIZE];
+    if (fgets(line, LINE_SIZE, file) == NULL
+	|| strcmp(line, "lisp-heap-dump 2\n") != 0)
+	fail("not a heap dump");
+
+    char * tok;
+    char * kind;
+    char * label;
+    while (fgets(line, LINE_SIZE, file) != NULL) {
+	if (strchr(line, '\n') == NULL)
+	    fail("line too long");
+
+	tok = strtok(line, " \n");
+	if (tok == NULL)
+	    continue;
+
+	if (strcmp(tok, "o") == 0) {
+	    char * addr = strtok(NULL, " \n");
+	    char * type = strtok(NULL, " \n");
+	    char * size = strtok(NULL, " \n");
+	    if (size == NULL)
+		fail("bad object line");
+	    add_obj(strtoull(addr, NULL, 16), type, strtoul(size, NULL, 10));
+	    while ((tok = strtok(NULL, " \n")) != NULL)
+		add_ref(strtoull(tok, NULL, 16));
+	}
+	else if (strcmp(tok, "r") == 0) {
+	    kind = strtok(NULL, " \n");
+	    label = strtok(NULL, " \n");
+	    tok = strtok(NULL, " \n");
+	    if (tok == NULL)
+		fail("bad root line");
+	    add_root(kind, label, strtoull(tok, NULL, 16));
+	}
+	else
+	    fail("bad line");
+    }
+    fclose(file);
+
+    if (obj_count == 0)
+	fail("no objects in the heap dump");
+
+    // print_top_objs finds each pair's cdr by its position.
+    for (long i = 0; i < obj_count; ++i)
+	if (strcmp(type_names[obj_types[i]], "pair") == 0
+	    && ref_start[i + 1] - ref_start[i] != 2)
+	    fail("a pair doesn't have two references");
+}
+
+
+void add_obj(uintptr_t addr, char * type, unsigned long size) {
+    // ref_start needs one more element than the other arrays.
+    if (obj_count + 1 >= obj_capacity) {
+	obj_capacity = (obj_capacity == 0 ? 1024 : obj_capacity * 2);
+	obj_addrs = grow(obj_addrs, obj_capacity, sizeof(uintptr_t));
+	obj_types = grow(obj_types, obj_capacity, sizeof(int));
+	obj_sizes = grow(obj_sizes, obj_capacity, sizeof(unsigned long));
+	ref_start = grow(ref_start, obj_capacity, sizeof(long));
+    }
+    obj_addrs[obj_count] = addr;
+    obj_types[obj_count] = type_index(type);
+    obj_sizes[obj_count] = size;
+    ref_start[obj_count] = ref_count;
+    ++obj_count;
+    ref_start[obj_count] = ref_count;
+}
+
+
+void add_ref(uintptr_t addr) {
+    if (obj_count == 0)
+	fail("reference before the first object");
+    if (ref_count == ref_capacity) {
+	ref_capacity = (ref_capacity == 0 ? 1024 : ref_capacity * 2);
+	refs = grow(refs, ref_capacity, sizeof(long));
+    }
+    refs[ref_count] = (long) addr;
+    ++ref_count;
+    ref_start[obj_count] = ref_count;
+}
+
+
+void add_root(char * kind, char * label, uintptr_t addr) {
+    if (root_count == root_capacity) {
+	root_capacity = (root_capacity == 0 ? 1024 : root_capacity * 2);
+	root_kinds = grow(root_kinds, root_capacity, sizeof(char *));
+	root_labels = grow(root_labels, root_capacity, sizeof(char *));
+	root_addrs = grow(root_addrs, root_capacity, sizeof(uintptr_t));
+    }
+    root_kinds[root_count] = copy_str(kind);
+    root_labels[root_count] = copy_str(label);
+    root_addrs[root_count] = addr;
+    ++root_count;
+}
+
+
+// type_index
+// Return the index of a type name in type_names, adding it if it's new.
+int type_index(char * type) {
+    for (int i = 0; i < type_count; ++i)
+	if (strcmp(type_names[i], type) == 0)
+	    return i;
+    if (type_count == MAX_TYPES)
+	fail("too many types");
+    type_names[type_count] = copy_str(type);
+    return type_count++;
+}
+
+
+// resolve_refs
+// Replace the addresses in refs with node numbers, and find the node of each
+// root.
+void resolve_refs() {
+    node_count = obj_count + 1;
+
+    addr_table_size = 1;
+    while (addr_table_size < 2 * (unsigned long) node_count)
+	addr_table_size *= 2;
+    addr_table = malloc(addr_table_size * sizeof(long));
+    if (addr_table == NULL)
+	fail("out of memory");
+    for (unsigned long i = 0; i < addr_table_size; ++i)
+	addr_table[i] = -1;
+
+    unsigned long h;
+    for (long i = 0; i < obj_count; ++i) {
+	h = (obj_addrs[i] >> 4) * 0x9E3779B97F4A7C15u;
+	for (h &= addr_table_size - 1; addr_table[h] != -1;
+	     h = (h + 1) & (addr_table_size - 1))
+	    ;
+	addr_table[h] = i + 1;
+    }
+
+    for (long i = 0; i < ref_count; ++i)
+	refs[i] = find_node((uintptr_t) refs[i]);
+
+    root_nodes = malloc((root_count + 1) * sizeof(long));
+    if (root_nodes == NULL)
+	fail("out of memory");
+    for (long i = 0; i < root_count; ++i)
+	root_nodes[i] = find_node(root_addrs[i]);
+}
+
+
+// find_node
+// Return the node of the object at an address, or -1 if there is none.
+long find_node(uintptr_t addr) {
+    unsigned long h = (addr >> 4) * 0x9E3779B97F4A7C15u;
+    for (h &= addr_table_size - 1; addr_table[h] != -1;
+	 h = (h + 1) & (addr_table_size - 1))
+	if (obj_addrs[addr_table[h] - 1] == addr)
+	    return addr_table[h];
+    return -1;
+}
+
+
+// ----------------------------------------------------------------------------
+// Dominators
+// ----------------------------------------------------------------------------
+
+// Iterate over the nodes that node n refers to. The super root refers to the
+// roots.
+#define FOR_EACH_SUCC(N, I, SUCC)					\
+    for (long I = ((N) == SUPER_ROOT ? 0 : ref_start[(N) - 1]);		\
+	 I < ((N) == SUPER_ROOT ? root_count : ref_start[(N)]); ++I)	\
+	if (((SUCC) = ((N) == SUPER_ROOT ? root_nodes[I] : refs[I])) != -1)
+
+
+// compute_dominators
+// Find the immediate dominator of every node reachable from the super root.
+void compute_dominators() {
+    postorder = malloc(node_count * sizeof(long));
+    post_num = malloc(node_count * sizeof(long));
+    idom = malloc(node_count * sizeof(long));
+    long * dfs_stack = malloc(node_count * sizeof(long));
+    long * dfs_next = malloc(node_count * sizeof(long));
+    if (postorder == NULL || post_num == NULL || idom == NULL
+	|| dfs_stack == NULL || dfs_next == NULL)
+	fail("out of memory");
+
+    // Depth-first search without recursion, since the graph can be millions
+    // of objects deep. dfs_next[n] is how far through its successors node n
+    // is, and post_num[n] is -2 while n is on the stack.
+    for (long n = 0; n < node_count; ++n)
+	post_num[n] = -1;
+    long depth = 0;
+    long n;
+    long succ;
+    dfs_stack[depth++] = SUPER_ROOT;
+    dfs_next[SUPER_ROOT] = 0;
+    post_num[SUPER_ROOT] = -2;
+    while (depth > 0) {
+	n = dfs_stack[depth - 1];
+	long end = (n == SUPER_ROOT ? root_count : ref_start[n]);
+	long base = (n == SUPER_ROOT ? 0 : ref_start[n - 1]);
+	succ = -1;
+	while (base + dfs_next[n] < end) {
+	    long i = base + dfs_next[n]++;
+	    succ = (n == SUPER_ROOT ? root_nodes[i] : refs[i]);
+	    if (succ != -1 && post_num[succ] == -1)
+		break;
+	    succ = -1;
+	}
+	if (succ != -1) {
+	    post_num[succ] = -2;
+	    dfs_next[succ] = 0;
+	    dfs_stack[depth++] = succ;
+	}
+	else {
+	    post_num[n] = reached_count;
+	    postorder[reached_count++] = n;
+	    --depth;
+	}
+    }
+    free(dfs_stack);
+    free(dfs_next);
+
+    // Turn the references into predecessor lists.
+    long * pred_start = calloc(node_count + 1, sizeof(long));
+    if (pred_start == NULL)
+	fail("out of memory");
+    for (n = 0; n < node_count; ++n)
+	if (post_num[n] >= 0)
+	    FOR_EACH_SUCC(n, i, succ)
+		++pred_start[succ + 1];
+    for (n = 0; n < node_count; ++n)
+	pred_start[n + 1] += pred_start[n];
+    long * preds = malloc((pred_start[node_count] + 1) * sizeof(long));
+    long * pred_fill = malloc(node_count * sizeof(long));
+    if (preds == NULL || pred_fill == NULL)
+	fail("out of memory");
+    memcpy(pred_fill, pred_start, node_count * sizeof(long));
+    for (n = 0; n < node_count; ++n)
+	if (post_num[n] >= 0)
+	    FOR_EACH_SUCC(n, i, succ)
+		preds[pred_fill[succ]++] = n;
+    free(pred_fill);
+
+    // Visit the nodes in reverse postorder until nothing changes.
+    for (n = 0; n < node_count; ++n)
+	idom[n] = -1;
+    idom[SUPER_ROOT] = SUPER_ROOT;
+    bool changed = true;
+    long new_idom;
+    long pred;
+    while (changed) {
+	changed = false;
+	for (long i = reached_count - 2; i >= 0; --i) {
+	    n = postorder[i];
+	    new_idom = -1;
+	    for (long j = pred_start[n]; j < pred_start[n + 1]; ++j) {
+		pred = preds[j];
+		if (idom[pred] == -1)
+		    continue;
+		new_idom = (new_idom == -1 ? pred : intersect(pred, new_idom));
+	    }
+	    if (idom[n] != new_idom) {
+		idom[n] = new_idom;
+		changed = true;
+	    }
+	}
+    }
+    free(pred_start);
+    free(preds);
+}
+
+
+// intersect
+// Return the nearest common dominator of two nodes.
+long intersect(long a, long b) {
+    while (a != b) {
+	while (post_num[a] < post_num[b])
+	    a = idom[a];
+	while (post_num[b] < post_num[a])
+	    b = idom[b];
+    }
+    return a;
+}
+
+
+// compute_retained
+// Add up the bytes and objects each node retains. A node comes after every
+// node it dominates in postorder, so one pass in postorder is enough.
+void compute_retained() {
+    retained_bytes = calloc(node_count, sizeof(unsigned long));
+    retained_objs = calloc(node_count, sizeof(unsigned long));
+    if (retained_bytes == NULL || retained_objs == NULL)
+	fail("out of memory");
+
+    long n;
+    for (long i = 0; i < reached_count; ++i) {
+	n = postorder[i];
+	if (n == SUPER_ROOT)
+	    continue;
+	retained_bytes[n] += obj_sizes[n - 1];
+	retained_objs[n] += 1;
+	retained_bytes[idom[n]] += retained_bytes[n];
+	retained_objs[idom[n]] += retained_objs[n];
+    }
+}
+
+
+// ----------------------------------------------------------------------------
+// Output
+// ----------------------------------------------------------------------------
+
+// print_census
+// Print the number of objects and bytes of each type, most bytes first.
+void print_census() {
+    unsigned long counts[MAX_TYPES] = {0};
+    unsigned long bytes[MAX_TYPES] = {0};
+    unsigned long total_bytes = 0;
+    unsigned long unreached_count = 0;
+    unsigned long unreached_bytes = 0;
+    for (long i = 0; i < obj_count; ++i) {
+	++counts[obj_types[i]];
+	bytes[obj_types[i]] += obj_sizes[i];
+	total_bytes += obj_sizes[i];
+	if (post_num[i + 1] < 0) {
+	    ++unreached_count;
+	    unreached_bytes += obj_sizes[i];
+	}
+    }
+
+    int order[MAX_TYPES];
+    for (int i = 0; i < type_count; ++i) {
+	int j = i;
+	for (; j > 0 && bytes[order[j - 1]] < bytes[i]; --j)
+	    order[j] = order[j - 1];
+	order[j] = i;
+    }
+
+    printf("Census: %ld objects, %lu bytes\n\n", obj_count, total_bytes);
+    printf("  %-16s %12s %14s\n", "type", "objects", "bytes");
+    for (int i = 0; i < type_count; ++i)
+	printf("  %-16s %12lu %14lu\n", type_names[order[i]],
+	       counts[order[i]], bytes[order[i]]);
+    if (unreached_count > 0)
+	printf("\n%lu objects (%lu bytes) can't be reached from any root.\n",
+	       unreached_count, unreached_bytes);
+}
+
+
+// print_top_roots
+// Print the roots that retain the most bytes. A root retains the objects
+// that can only be reached from it; an object that several roots refer to
+// is listed once, with the first of them.
+void print_top_roots(long count) {
+    long * order = malloc((root_count + 1) * sizeof(long));
+    long * sharers = calloc(node_count, sizeof(long));
+    if (order == NULL || sharers == NULL)
+	fail("out of memory");
+
+    long n;
+    long listed = 0;
+    for (long i = 0; i < root_count; ++i) {
+	n = root_nodes[i];
+	if (n == -1 || idom[n] != SUPER_ROOT)
+	    continue;
+	if (sharers[n]++ == 0)
+	    order[listed++] = i;
+    }
+    qsort(order, listed, sizeof(long), compare_roots);
+
+    printf("\nTop retainers by root:\n\n");
+    printf("  %14s %12s  %s\n", "retained bytes", "objects", "root");
+    for (long i = 0; i < listed && i < count; ++i) {
+	n = root_nodes[order[i]];
+	printf("  %14lu %12lu  %s", retained_bytes[n], retained_objs[n],
+	       root_name(order[i]));
+	if (sharers[n] > 1)
+	    printf(" (and %ld other roots)", sharers[n] - 1);
+	printf("\n");
+    }
+    free(order);
+    free(sharers);
+}
+
+
+// print_top_objs
+// Print the objects that retain the most bytes, and the root each one is
+// retained through.
+void print_top_objs(long count) {
+    // The root that refers to each node that the super root dominates.
+    long * root_of = malloc(node_count * sizeof(long));
+    long * order = malloc(node_count * sizeof(long));
+    if (root_of == NULL || order == NULL)
+	fail("out of memory");
+    for (long n = 0; n < node_count; ++n)
+	root_of[n] = -1;
+    for (long i = root_count - 1; i >= 0; --i)
+	if (root_nodes[i] != -1)
+	    root_of[root_nodes[i]] = i;
+
+    // Only list the head of a list, not each of the pairs after it, which
+    // would otherwise crowd out everything else. An object is left out if it
+    // is the cdr of the pair that dominates it, so the elements of a list,
+    // such as closures and the frames they keep alive, are still listed.
+    int pair_type = -1;
+    for (int i = 0; i < type_count; ++i)
+	if (strcmp(type_names[i], "pair") == 0)
+	    pair_type = i;
+
+    long listed = 0;
+    long p;
+    for (long n = 1; n < node_count; ++n) {
+	if (post_num[n] < 0)
+	    continue;
+	p = idom[n];
+	if (p != SUPER_ROOT && obj_types[p - 1] == pair_type
+	    && refs[ref_start[p - 1] + 1] == n)
+	    continue;
+	order[listed++] = n;
+    }
+    qsort(order, listed, sizeof(long), compare_nodes);
+
+    printf("\nTop retainers by object:\n\n");
+    printf("  %14s %12s  %-16s %-18s  %s\n", "retained bytes", "objects",
+	   "type", "address", "retained through");
+    long n;
+    long top;
+    for (long i = 0; i < listed && i < count; ++i) {
+	n = order[i];
+	for (top = n; idom[top] != SUPER_ROOT; top = idom[top])
+	    ;
+	printf("  %14lu %12lu  %-16s %#-18lx  %s\n", retained_bytes[n],
+	       retained_objs[n], type_names[obj_types[n - 1]],
+	       (unsigned long) obj_addrs[n - 1],
+	       (root_of[top] != -1 ? root_name(root_of[top]) : "?"));
+    }
+    free(root_of);
+    free(order);
+}
+
+
+// compare_roots
+// Order roots by the bytes they retain, most first.
+int compare_roots(const void * a, const void * b) {
+    unsigned long x = retained_bytes[root_nodes[*(const long *) a]];
+    unsigned long y = retained_bytes[root_nodes[*(const long *) b]];
+    return (x < y) - (x > y);
+}
+
+
+// compare_nodes
+// Order nodes by the bytes they retain, most first.
+int compare_nodes(const void * a, const void * b) {
+    unsigned long x = retained_bytes[*(const long *) a];
+    unsigned long y = retained_bytes[*(const long *) b];
+    return (x < y) - (x > y);
+}
+
+
+// root_name
+// Return a description of a root, such as "global foo".
+char * root_name(long root) {
+    static char name[LINE_SIZE + 32];
+    snprintf(name, sizeof(name), "%s %s", root_kinds[root], root_labels[root]);
+    return name;
+}
+
+
+// ----------------------------------------------------------------------------
+// Utilities
+// ----------------------------------------------------------------------------
+
+// grow
+// Reallocate an array to have room for capacity elements.
+void * grow(void * array, long capacity, size_t elem_size) {
+    array = realloc(array, capacity * elem_size);
+    if (array == NULL)
+	fail("out of memory");
+    return array;
+}
+
+
+char * copy_str(char * str) {
+    char * copy = grow(NULL, strlen(str) + 1, 1);
+    strcpy(copy, str);
+    return copy;
+}
+
+
+void fail(char * message) {
+    fprintf(stderr, "heap-summary: %s\n", message);
+    exit(1);
+}